@@ -0,0 +1,56 @@
+#ifndef LAFRPC_CHUNKSTORE_H
+#define LAFRPC_CHUNKSTORE_H
+
+#include <list>
+#include <QtCore/qdir.h>
+#include <QtCore/qhash.h>
+#include <QtCore/qmutex.h>
+#include "utils.h"
+
+BEGIN_LAFRPC_NAMESPACE
+
+// keeps the content-defined chunks received before, keyed by their sha256. the sender skips the chunks stored here.
+// get() and put() are called in worker threads, a batch at a time, so they may block but must be thread-safe.
+class RpcChunkStore
+{
+public:
+    virtual ~RpcChunkStore();
+public:
+    // return empty if the chunk is not stored.
+    virtual QByteArray get(const QByteArray &hash) = 0;
+    virtual bool put(const QByteArray &hash, const QByteArray &data) = 0;
+};
+
+// one file per chunk under the root directory. the least recently used chunks are removed if they take more than
+// capacity bytes. the order of use starts from the modified times of chunks after restarting.
+class NativeRpcChunkStore : public RpcChunkStore
+{
+public:
+    NativeRpcChunkStore(const QString &root, quint64 capacity);
+public:
+    virtual QByteArray get(const QByteArray &hash) override;
+    virtual bool put(const QByteArray &hash, const QByteArray &data) override;
+    quint64 usedBytes() const;
+private:
+    struct Entry
+    {
+        QByteArray hash;
+        quint64 size;
+    };
+    QString makePath(const QByteArray &hash) const;
+    void load();
+    void remove(const QByteArray &hash);
+    void evict();
+private:
+    QDir rootDir;
+    quint64 capacity;
+    quint64 used;
+    // the most recently used chunk goes first.
+    std::list<Entry> lru;
+    QHash<QByteArray, std::list<Entry>::iterator> entries;
+    mutable QMutex mutex;
+};
+
+END_LAFRPC_NAMESPACE
+
+#endif  // LAFRPC_CHUNKSTORE_H
@@ -0,0 +1,39 @@
+#ifndef LAFRPC_CHUNKSTORE_P_H
+#define LAFRPC_CHUNKSTORE_P_H
+
+#include <functional>
+#include "qtnetworkng.h"
+#include "chunkstore.h"
+
+BEGIN_LAFRPC_NAMESPACE
+
+// the FastCDC chunking with normalized chunk sizes. the gear table is fixed, so every peer cuts the same content at
+// the same points.
+struct FastCdc
+{
+    static const int MinSize = 8 * 1024;
+    static const int AverageSize = 32 * 1024;
+    static const int MaxSize = 128 * 1024;
+    // return the length of the first chunk. data should hold MaxSize bytes unless it is the end of file.
+    static int cut(const char *data, int size);
+};
+
+// the sender cuts a batch of chunks and sends their hashes, the receiver answers which ones it has in the chunk
+// store, then only the others are sent. the sha256 of whole content ends the transfer.
+struct ChunkedTransfer
+{
+    typedef std::function<bool(const QByteArray &frame)> Sender;
+    typedef std::function<QByteArray()> Receiver;
+    typedef std::function<bool(qint64 bs)> Progress;
+
+    static bool send(QSharedPointer<qtng::FileLike> f, quint64 size, const Sender &sendFrame,
+                     const Receiver &recvFrame, const Progress &progress, QByteArray *hash);
+    static bool recv(QSharedPointer<qtng::FileLike> f, quint64 size, QSharedPointer<RpcChunkStore> store,
+                     const Sender &sendFrame, const Receiver &recvFrame, const Progress &progress, QByteArray *hash);
+
+    static const int BatchSize = 32;
+};
+
+END_LAFRPC_NAMESPACE
+
+#endif  // LAFRPC_CHUNKSTORE_P_H
@@ -0,0 +1,60 @@
+#ifndef LAFRPC_COALESCING_P_H
+#define LAFRPC_COALESCING_P_H
+
+#include "wrapped_socket_p.h"
+
+BEGIN_LAFRPC_NAMESPACE
+
+// gather the packets written in the same event-loop tick, and write them to the backend in one call.
+class CoalescingSocket : public WrappedSocket
+{
+public:
+    CoalescingSocket(QSharedPointer<qtng::SocketLike> backend, quint32 maxBytes, quint32 maxDelay);
+    virtual ~CoalescingSocket() override;
+public:
+    virtual bool isValid() const override;
+    virtual void close() override;
+    virtual void abort() override;
+    virtual qint32 send(const char *data, qint32 size) override;
+    virtual qint32 sendall(const char *data, qint32 size) override;
+    virtual qint32 send(const QByteArray &data) override;
+    virtual qint32 sendall(const QByteArray &data) override;
+private:
+    bool flush();
+    bool writeBuffer();
+    void flushLater();
+private:
+    QByteArray buffer;
+    qtng::Lock writing;
+    qtng::CoroutineGroup *operations;
+    const quint32 maxBytes;
+    const quint32 maxDelay;
+    bool flushing;
+    bool broken;
+};
+
+// read the backend in large chunks, so the small header and payload reads of a channel cost one syscall for many
+// packets.
+class BufferedReadSocket : public WrappedSocket
+{
+public:
+    BufferedReadSocket(QSharedPointer<qtng::SocketLike> backend, quint32 bufferSize);
+public:
+    virtual qint32 peek(char *data, qint32 size) override;
+    virtual qint32 peekRaw(char *data, qint32 size) override;
+    virtual qint32 recv(char *data, qint32 size) override;
+    virtual qint32 recvall(char *data, qint32 size) override;
+    virtual QByteArray recv(qint32 size) override;
+    virtual QByteArray recvall(qint32 size) override;
+private:
+    qint32 fill();
+    qint32 take(char *data, qint32 size);
+private:
+    QByteArray buffer;
+    qint32 position;
+    const quint32 bufferSize;
+};
+
+END_LAFRPC_NAMESPACE
+
+#endif  // LAFRPC_COALESCING_P_H
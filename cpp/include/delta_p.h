@@ -0,0 +1,60 @@
+#ifndef LAFRPC_DELTA_P_H
+#define LAFRPC_DELTA_P_H
+
+#include <QtCore/qbytearray.h>
+#include <QtCore/qhash.h>
+#include <QtCore/qvector.h>
+#include "utils.h"
+
+BEGIN_LAFRPC_NAMESPACE
+
+// the weak checksum of rsync, it can be rolled one byte forward cheaply.
+class RollingChecksum
+{
+public:
+    RollingChecksum();
+public:
+    void reset(const char *data, quint32 length);
+    void roll(uchar out, uchar in);
+    quint32 value() const { return (a & 0xffff) | (b << 16); }
+private:
+    quint32 a;
+    quint32 b;
+    quint32 length;
+};
+
+// the signatures of every full block of the old file, the receiver sends them to the sender of new file.
+struct DeltaSignatures
+{
+    DeltaSignatures();
+
+    // about the square root of file size, so the signatures and the references grow slowly.
+    static quint32 chooseBlockSize(quint64 fileSize);
+    static QByteArray strongHash(const char *data, int size);
+    // blocking, call it in thread.
+    static DeltaSignatures calculate(const QString &filePath);
+
+    QByteArray save() const;
+    bool restore(quint32 blockSize, quint32 count, const QByteArray &data);
+    // return the index of block with the same content, or -1.
+    qint64 find(quint32 weak, const char *data) const;
+    quint32 count() const { return static_cast<quint32>(weak.size()); }
+
+    // the size of one encoded signature.
+    static const int EntrySize = 4 + 16;
+    static const quint32 MinBlockSize = 2048;
+    static const quint32 MaxBlockSize = 128 * 1024;
+    // enough for a basis file of 512GB with the largest blocks.
+    static const quint32 MaxCount = 4 * 1024 * 1024;
+    // the signatures come from the peer, check the header before receiving them.
+    static bool isValid(quint32 blockSize, quint32 count);
+
+    quint32 blockSize;
+    QVector<quint32> weak;
+    QVector<QByteArray> strong;
+    QMultiHash<quint32, quint32> blocks;
+};
+
+END_LAFRPC_NAMESPACE
+
+#endif  // LAFRPC_DELTA_P_H
@@ -78,9 +78,16 @@ public:
     QSharedPointer<qtng::SocketLike> takeRawSocket(const QString &peerName, const QByteArray &connectionId);
 
     // connect to peer name or address, if disconnected, do reconnect.
+    // with connectionsPerPeer(), the other connections are made in background.
     QSharedPointer<Peer> connect(const QString &peerNameOrAddress);
 
+    // keep the peer connected in background with one more connection than connectionsPerPeer(), at least two.
+    // reconnect with backoff if one is dropped.
+    bool supervise(const QString &peerNameOrAddress);
+    void unsupervise(const QString &peerNameOrAddress);
+
     // get peer for name, if disconnected, return nullptr.
+    // in shard mode, the peer may live in a worker thread, use it in its own thread.
     QSharedPointer<Peer> get(const QString &peerName) const;
 
     // get all peers with the peer name. some one may disconnected.
@@ -92,6 +99,9 @@ public:
     // get all peers, some one may disconnected.
     QList<QSharedPointer<Peer>> getAllPeers() const;
 
+    // get the peer with Peer::id(), return nullptr if it is gone.
+    QSharedPointer<Peer> getById(quint64 peerId) const;
+
     // is the peer connected?
     bool isConnected(const QString &peerName) const;
 
@@ -141,6 +151,28 @@ public:
     RpcBuilder &payloadSizeHint(quint32 payloadSizeHint);
     RpcBuilder &keepaliveTimeout(float keepaliveTimeout);
     RpcBuilder &myPeerName(const QString &myPeerName);
+    // dispatch accepted peers to event-loop threads. services and settings are copied when servers start.
+    RpcBuilder &workerThreads(int workerThreads);
+    // every worker thread listens tcp/ssl addresses using SO_REUSEPORT, and accepts connections by itself.
+    RpcBuilder &reusePort(bool reusePort);
+    // run at most n tls handshakes in other threads at the same time. 0 means handshaking in the event loop.
+    RpcBuilder &handshakeThreads(int handshakeThreads);
+    // inproc:// peers pass requests and responses by reference. force serialization to keep the isolation of tcp.
+    RpcBuilder &forceSerialization(bool forceSerialization);
+    // gather the packets written in one event-loop tick up to maxBytes, and wait at most maxDelay seconds. 0 disables.
+    RpcBuilder &writeCoalescing(quint32 maxBytes, float maxDelay = 0.0f);
+    // read the peer connections in chunks of bufferSize bytes, so many small packets cost one recv(). 0 disables.
+    RpcBuilder &readCoalescing(quint32 bufferSize);
+    // keep n connections to every peer connected by name, connect() and get() return the least busy one.
+    RpcBuilder &connectionsPerPeer(int connectionsPerPeer);
+    // the raw sockets accepted by servers are closed if not taken in time, and at most maxRawSockets are kept.
+    RpcBuilder &rawSocketTimeout(float rawSocketTimeout);
+    RpcBuilder &maxRawSockets(int maxRawSockets);
+    // keep at most n idle raw sockets to every peer for rawSocketTimeout, and reuse them for the next use-stream.
+    // 0 disables, which is the default.
+    RpcBuilder &rawSocketPoolSize(int rawSocketPoolSize);
+    // cache the resolved addresses for ttl seconds, and the failures for negativeTtl seconds.
+    RpcBuilder &dnsTtl(float ttl, float negativeTtl = 5.0f);
     RpcBuilder &httpRootDir(const QDir &rootDir);
     RpcBuilder &httpSession(const QSharedPointer<qtng::HttpSession> session);
 
@@ -1,6 +1,13 @@
 #ifndef LAFRPC_RPC_P_H
 #define LAFRPC_RPC_P_H
+#include <QtCore/qmutex.h>
+#include <QtCore/qhash.h>
+#include <QtCore/qreadwritelock.h>
+#include <QtCore/qset.h>
+#include <QtCore/qthread.h>
+#include <QtCore/qwaitcondition.h>
 #include "rpc.h"
+#include "transport.h"
 
 BEGIN_LAFRPC_NAMESPACE
 
@@ -10,6 +17,140 @@ struct PeerAndHeader
     QVariantMap header;
 };
 
+// the peers of one rpc and its shards, which is shared between threads. the peers are spread over buckets by name,
+// address and id, and every bucket has its own lock, so the threads seldom wait for each other. the flat lists of all
+// peers and names are implicitly shared, so values() and keys() copy nothing. the flat lock is taken inside the
+// bucket locks, never the other way.
+class PeerDirectory
+{
+public:
+    PeerDirectory();
+public:
+    void insert(const QString &name, const QSharedPointer<Peer> &peer);
+    bool remove(const QString &name, Peer *peer);
+    bool contains(const QString &name) const;
+    QSharedPointer<Peer> value(const QString &name) const;
+    QList<QSharedPointer<Peer>> values(const QString &name) const;
+    QList<QSharedPointer<Peer>> values() const;
+    QStringList keys() const;
+    QSharedPointer<Peer> findByAddress(const QString &address) const;
+    QSharedPointer<Peer> findById(quint64 id) const;
+private:
+    struct Entry
+    {
+        QSharedPointer<Peer> peer;
+        // the name and address the peer is inserted with. the address may be changed later.
+        QString name;
+        QString address;
+    };
+    struct Bucket
+    {
+        mutable QReadWriteLock lock;
+        QHash<QString, QList<QSharedPointer<Peer>>> byName;
+        QHash<QString, QList<QSharedPointer<Peer>>> byAddress;
+        QHash<quint64, Entry> byId;
+    };
+    enum { BucketCount = 16 };
+    Bucket &bucket(const QString &key) { return buckets[qHash(key) % BucketCount]; }
+    const Bucket &bucket(const QString &key) const { return buckets[qHash(key) % BucketCount]; }
+    Bucket &bucket(quint64 id) { return buckets[qHash(id) % BucketCount]; }
+    const Bucket &bucket(quint64 id) const { return buckets[qHash(id) % BucketCount]; }
+private:
+    Bucket buckets[BucketCount];
+    mutable QMutex flatLock;
+    QList<QSharedPointer<Peer>> all;
+    QStringList names;
+};
+
+// a fixed set of threads shared by one rpc and its shards. the tls handshakes are queued to them, and the calling
+// coroutine waits for the result without blocking its event loop.
+class HandshakePool
+{
+public:
+    explicit HandshakePool(int threads);
+    ~HandshakePool();
+public:
+    bool handshake(QSharedPointer<qtng::SslSocket> ssl, bool asServer);
+    int size() const { return workers.size(); }
+private:
+    struct Job
+    {
+        QSharedPointer<qtng::SslSocket> ssl;
+        // the thread of the calling coroutine, which owns the socket and releases it.
+        QThread *owner;
+        bool asServer;
+        bool running;
+        bool done;
+        bool cancelled;
+        bool result;
+        int notifier;
+    };
+    void work();
+    void releaseAbandoned();
+private:
+    class Worker;
+    QMutex mutex;
+    QWaitCondition condition;
+    QList<QSharedPointer<Job>> jobs;
+    // the jobs cancelled while running. they are released by their owner threads.
+    QList<QSharedPointer<Job>> abandoned;
+    QList<QThread *> workers;
+    bool stopping;
+};
+
+// an event-loop thread owns a child rpc, which serves the peers dispatched by the parent rpc.
+class RpcShard : public QThread
+{
+public:
+    RpcShard(QSharedPointer<Rpc> rpc, int index);
+    virtual ~RpcShard() override;
+public:
+    bool post(const std::function<void(Rpc *)> &task);
+    void stop();
+    Rpc *child() const { return rpc.data(); }
+protected:
+    virtual void run() override;
+private:
+    void wakeup();
+public:
+    const int index;
+private:
+    QSharedPointer<Rpc> rpc;
+    QMutex mutex;
+    QList<std::function<void(Rpc *)>> tasks;
+    int fds[2];
+    bool stopping;
+};
+
+// resolve host names with ttl, negative caching and refreshing in background before the entries are expired.
+class Resolver
+{
+public:
+    Resolver();
+    ~Resolver();
+public:
+    QList<qtng::HostAddress> resolve(const QString &hostName);
+    void prefetch(const QString &hostName);
+    // connect to the addresses of host, racing ipv6 and ipv4 like rfc 8305.
+    QSharedPointer<qtng::Socket> connect(const QString &hostName, quint16 port);
+private:
+    QList<qtng::HostAddress> lookup(const QString &hostName);
+    void refreshLater(const QString &hostName);
+public:
+    quint64 ttl;
+    quint64 negativeTtl;
+    quint32 connectionAttemptDelay;
+private:
+    struct Entry
+    {
+        QList<qtng::HostAddress> addresses;
+        qint64 expireAt;
+    };
+    QMap<QString, Entry> entries;
+    QMap<QString, QSharedPointer<qtng::ValueEvent<QList<qtng::HostAddress>>>> pending;
+    qtng::CoroutineGroup *operations;
+};
+
 class Transport;
 class TcpTransport;
 class RpcPrivate
@@ -26,6 +167,16 @@ public:
     void shutdown();
     bool waitServers();
     QSharedPointer<Peer> connect(const QString &peerName);
+    QSharedPointer<Peer> connectOne(QSharedPointer<Transport> transport, const QString &peerName,
+                                    const QString &peerAddress);
+    void fillPool(const QString &peerName, const QString &peerAddress);
+    QSharedPointer<Peer> leastBusyPeer(const QString &peerName, const QString &peerAddress = QString()) const;
+    void supervise(const QString &peerNameOrAddress);
+    void reapRawSockets();
+    void expireRawSocketPool();
+    QSharedPointer<qtng::SocketLike> recyclable(const QString &peerName, QSharedPointer<qtng::SocketLike> rawSocket);
+    QSharedPointer<qtng::SocketLike> recyclable(QSharedPointer<Transport> transport,
+                                                QSharedPointer<qtng::SocketLike> rawSocket);
     QSharedPointer<qtng::SocketLike> makeRawSocket(const QString &peerName, QByteArray &connectionId);
     QSharedPointer<qtng::SocketLike> takeRawSocket(const QString &peerName, const QByteArray &connectionId);
     bool isConnected(const QString &peerName) const;
@@ -35,9 +186,17 @@ public:
     QSharedPointer<Peer> preparePeer(const QSharedPointer<qtng::DataChannel> &channel, const QString &peerName,
                                      const QString &peerAddress);
     inline QSharedPointer<Transport> findTransport(const QString &address);
+    QSharedPointer<Transport> findTransportByName(const QString &name) const;
     void setCurrentPeerAndHeader(const QPointer<Peer> &peer, const QVariantMap &header);
     void deleteCurrentPeerAndHeader();
     void removePeer(const QString &name, Peer *peer);
+    bool startShards();
+    void stopShards();
+    bool dispatchPeer(QSharedPointer<qtng::SocketLike> request, const QString &transportName, const QString &address);
+    void serveInShards(const QString &address);
+    void copySettings(const RpcPrivate *other);
+    void setHandshakeThreads(int handshakeThreads);
+    bool handshake(QSharedPointer<qtng::SslSocket> ssl, bool asServer);
 
     static inline RpcPrivate *getPrivateHelper(Rpc *rpc) { return rpc->d_func(); }
 public:
@@ -46,7 +205,7 @@ public:
     quint32 payloadSizeHint;
     quint64 keepaliveTimeout;
     qtng::KcpSocket::Mode kcpMode;
-    QMultiMap<QString, QSharedPointer<Peer>> peers;
+    QSharedPointer<PeerDirectory> peers;
     QSharedPointer<HeaderCallback> headerCallback;
     QSharedPointer<LoggingCallback> loggingCallback;
     QSharedPointer<KcpFilter> kcpFilter;
@@ -55,9 +214,28 @@ public:
     QStringList serverAddressList;
     QMap<QString, QString> knownAddresses;
     QMap<QString, QSharedPointer<qtng::Event>> connectingEvents;
+    QMap<QString, QSharedPointer<qtng::Event>> shardServerStops;
     QMap<quintptr, PeerAndHeader> localStore;
     qtng::CoroutineGroup *operations;
     QSharedPointer<qtng::SocketDnsCache> dnsCache;
+    QSharedPointer<Resolver> resolver;
+    int workerThreads;
+    bool reusePort;
+    int handshakeThreads;
+    bool forceSerialization;
+    quint32 coalescingBytes;
+    quint32 coalescingDelay;
+    quint32 readBufferSize;
+    int connectionsPerPeer;
+    quint64 rawSocketTimeout;
+    int maxRawSockets;
+    int rawSocketPoolSize;
+    QMap<QString, QList<RawSocket>> rawSocketPool;
+    QSet<QString> fillingPools;
+    QSharedPointer<HandshakePool> handshakePool;
+    QList<RpcShard *> shards;
+    int nextShard;
+    Rpc *shardParent;
 private:
     Rpc * const q_ptr;
     Q_DECLARE_PUBLIC(Rpc)
@@ -2,6 +2,7 @@
 #define LAFRPC_SENDDIR_H
 
 #include "base.h"
+#include "chunkstore.h"
 #include <QtCore/qfile.h>
 #include <QtCore/qsharedpointer.h>
 
@@ -71,6 +72,20 @@ public:
     void setLastAccess(const QDateTime &dt);
     QList<RpcDirFileEntry> entries() const;
     void setEntries(const QList<RpcDirFileEntry> &entries);
+    // see RpcFile::setChunked(), every file is chunked and the chunk store is shared by them.
+    bool chunked() const;
+    void setChunked(bool chunked);
+    QSharedPointer<RpcChunkStore> chunkStore() const;
+    void setChunkStore(QSharedPointer<RpcChunkStore> chunkStore);
+    // send n files at the same time, every one in its own sub channel.
+    int concurrency() const;
+    void setConcurrency(int concurrency);
+    // the files smaller than it are packed into one stream instead of a sub channel for each. 0 disables packing.
+    quint64 packThreshold() const;
+    void setPackThreshold(quint64 packThreshold);
+    // see RpcFile::setMemoryMapped(), readFromPath() maps the files. it is not sent to the peer.
+    bool memoryMapped() const;
+    void setMemoryMapped(bool memoryMapped);
 public:
     QVariantMap saveState();
     bool restoreState(const QVariantMap &state);
@@ -96,6 +111,7 @@ class NativeRpcDirFileProvider : public RpcDirFileProvider
 public:
     NativeRpcDirFileProvider(const QString &root)
         : rootDir(root)
+        , memoryMapped(false)
     {
         rootDir.makeAbsolute();
     }
@@ -106,6 +122,8 @@ public:
     QString makePath(const QString &filePath);
 public:
     QDir rootDir;
+    // open the files for reading as memory mappings, see RpcFile::setMemoryMapped().
+    bool memoryMapped;
 };
 
 END_LAFRPC_NAMESPACE
@@ -2,6 +2,7 @@
 #define LAFRPC_SENDFILE_H
 
 #include "base.h"
+#include "chunkstore.h"
 #include <QtCore/qfile.h>
 #include <QtCore/qsharedpointer.h>
 
@@ -12,7 +13,8 @@ class RpcFile : public UseStream
 {
 public:
     typedef std::function<bool(qint64 bs, quint64 count, quint64 total)> ProgressCallback;
-    explicit RpcFile(const QString &filePath, bool withHash = false);
+    // with hashWhileSending, the sha256 is calculated as the blocks are sent and follows them as a trailer.
+    explicit RpcFile(const QString &filePath, bool withHash = false, bool hashWhileSending = false);
     explicit RpcFile();
     virtual ~RpcFile() override;
 public:
@@ -20,7 +22,10 @@ public:
     bool calculateHash();
     bool isValid() const;
 
-    bool writeToPath(const QString &path, ProgressCallback progressCallback = nullptr);
+    // with resume, the receiver keeps the content of path if the sender is resumable and has the same prefix.
+    // otherwise the file is truncated. a broken transfer leaves the prefix received without gaps, but a receiver
+    // killed during a parallel transfer may leave later blocks, and the next resume starts over from 0.
+    bool writeToPath(const QString &path, ProgressCallback progressCallback = nullptr, bool resume = false);
     bool readFromPath(const QString &path, ProgressCallback progressCallback = nullptr);
     bool readFromPath(ProgressCallback progressCallback = nullptr);
     bool writeTo(QSharedPointer<qtng::FileLike> f, ProgressCallback progressCallback = nullptr);
@@ -41,6 +46,29 @@ public:
     void setLastAccess(const QDateTime &dt);
     QByteArray hash() const;
     void setHash(const QByteArray &hash);  // sha256
+    bool hashWhileSending() const;
+    void setHashWhileSending(bool hashWhileSending);
+    // send large files over n sub channels at the same time. the raw socket is always a single stream.
+    int parallelStreams() const;
+    void setParallelStreams(int streams);
+    // the receiver may go on from the bytes it already holds, see writeToPath().
+    bool resumable() const;
+    void setResumable(bool resumable);
+    // the receiver sends the block signatures of the file at writeToPath(), only the changed bytes are sent back.
+    bool delta() const;
+    void setDelta(bool delta);
+    // the content is cut into chunks, and the receiver takes the chunks it already has from its chunk store.
+    bool chunked() const;
+    void setChunked(bool chunked);
+    QSharedPointer<RpcChunkStore> chunkStore() const;
+    void setChunkStore(QSharedPointer<RpcChunkStore> chunkStore);
+    // the receiver reserves the disk space of writeToPath() before the content comes. it is not sent to the peer.
+    bool preallocate() const;
+    void setPreallocate(bool preallocate);
+    // readFromPath() sends from a memory mapping of the file. the process gets SIGBUS if another one truncates the
+    // file while it is sent, so only use it for files nobody changes. it is not sent to the peer.
+    bool memoryMapped() const;
+    void setMemoryMapped(bool memoryMapped);
 public:
     QVariantMap saveState();
     bool restoreState(const QVariantMap &state);
@@ -0,0 +1,79 @@
+#ifndef LAFRPC_SHM_P_H
+#define LAFRPC_SHM_P_H
+
+#include "qtnetworkng.h"
+#include "utils.h"
+
+BEGIN_LAFRPC_NAMESPACE
+
+struct ShmRing;
+
+// a pair of single-producer/single-consumer ring buffers in shared memory. the bootstrap unix socket exchanges the
+// name of segment, and carries the doorbell bytes waking the other side up.
+class ShmSocket : public qtng::SocketLike
+{
+public:
+    virtual ~ShmSocket() override;
+    static QSharedPointer<ShmSocket> handshake(QSharedPointer<qtng::SocketLike> bootstrap, bool asServer);
+public:
+    virtual qtng::Socket::SocketError error() const override;
+    virtual QString errorString() const override;
+    virtual bool isValid() const override;
+    virtual qtng::HostAddress localAddress() const override;
+    virtual quint16 localPort() const override;
+    virtual qtng::HostAddress peerAddress() const override;
+    virtual QString peerName() const override;
+    virtual quint16 peerPort() const override;
+    virtual qintptr fileno() const override;
+    virtual qtng::Socket::SocketType type() const override;
+    virtual qtng::Socket::SocketState state() const override;
+    virtual qtng::HostAddress::NetworkLayerProtocol protocol() const override;
+
+    virtual qtng::Socket *acceptRaw() override;
+    virtual QSharedPointer<qtng::SocketLike> accept() override;
+    virtual bool bind(const qtng::HostAddress &address, quint16 port = 0,
+                      qtng::Socket::BindMode mode = qtng::Socket::DefaultForPlatform) override;
+    virtual bool bind(quint16 port = 0, qtng::Socket::BindMode mode = qtng::Socket::DefaultForPlatform) override;
+    virtual bool connect(const qtng::HostAddress &addr, quint16 port) override;
+    virtual bool connect(
+            const QString &hostName, quint16 port,
+            QSharedPointer<qtng::SocketDnsCache> dnsCache = QSharedPointer<qtng::SocketDnsCache>()) override;
+    virtual void close() override;
+    virtual void abort() override;
+    virtual bool listen(int backlog) override;
+    virtual bool setOption(qtng::Socket::SocketOption option, const QVariant &value) override;
+    virtual QVariant option(qtng::Socket::SocketOption option) const override;
+
+    virtual qint32 peek(char *data, qint32 size) override;
+    virtual qint32 peekRaw(char *data, qint32 size) override;
+    virtual qint32 recv(char *data, qint32 size) override;
+    virtual qint32 recvall(char *data, qint32 size) override;
+    virtual qint32 send(const char *data, qint32 size) override;
+    virtual qint32 sendall(const char *data, qint32 size) override;
+    virtual QByteArray recv(qint32 size) override;
+    virtual QByteArray recvall(qint32 size) override;
+    virtual qint32 send(const QByteArray &data) override;
+    virtual qint32 sendall(const QByteArray &data) override;
+public:
+    QSharedPointer<qtng::SocketLike> bootstrap;
+private:
+    ShmSocket(QSharedPointer<qtng::SocketLike> bootstrap, char *mapped, quint32 capacity, bool asServer);
+    qint32 read(char *data, qint32 size, bool consume);
+    void watch();
+    void ring();
+private:
+    char *mapped;
+    quint32 capacity;
+    ShmRing *tx;
+    ShmRing *rx;
+    char *txData;
+    char *rxData;
+    qtng::Event changed;
+    qtng::Lock doorbellLock;
+    qtng::CoroutineGroup *operations;
+    bool broken;
+};
+
+END_LAFRPC_NAMESPACE
+
+#endif  // LAFRPC_SHM_P_H
@@ -2,6 +2,7 @@
 #define LAFRPC_TRANSPORT_H
 
 #include <QtCore/QDateTime>
+#include <QtCore/qmutex.h>
 #include "qtnetworkng.h"
 #include "utils.h"
 
@@ -34,18 +35,38 @@ public:
     virtual QSharedPointer<qtng::SocketLike> makeRawSocket(const QString &address, QByteArray &connectionId);
     virtual QSharedPointer<qtng::SocketLike> takeRawSocket(const QByteArray &connectionId);
     virtual bool canHandle(const QString &address) = 0;
+    // can the server share its address with other shards using SO_REUSEPORT?
+    virtual bool canReusePort() const;
+    // do the raw sockets carry the bytes as they are? then the kernel can copy files to them directly.
+    virtual bool isPlain() const;
+    // can the accepted peers be served by the shard threads? the transports bound to this thread say no.
+    virtual bool canDispatch() const;
     bool handleRequest(QSharedPointer<qtng::SocketLike> request, QByteArray &rpcHeader);
+    // turn a handshaked connection into peer, may be called by the shard thread.
+    void acceptPeer(QSharedPointer<qtng::SocketLike> request, const QString &address);
+    // ask the server side to register the connection as a raw socket, which may be a pooled one.
+    static bool handshakeRawSocket(QSharedPointer<qtng::SocketLike> request, QByteArray &connectionId);
+    // close the raw sockets which are not taken in `timeout` msecs.
+    int reapRawSockets(qint64 timeout);
+    // wait for the next handshake on a raw socket given back by the pool of the other side.
+    void recycleRawSocket(QSharedPointer<qtng::SocketLike> request);
 protected:
     virtual QSharedPointer<qtng::SocketLike> createConnection(const QString &address, const QString &host, quint16 port,
                                                               QSharedPointer<qtng::SocketDnsCache> dnsCache) = 0;
     virtual QSharedPointer<qtng::BaseStreamServer> createServer(const QString &address, const qtng::HostAddress &host,
                                                                 quint16 port) = 0;
     virtual QString getAddressTemplate() = 0;
+    virtual QString getPeerAddress(QSharedPointer<qtng::SocketLike> request);
     virtual bool parseAddress(const QString &address, QString &host, quint16 &port);
+    virtual void setupChannel(QSharedPointer<qtng::SocketLike> request, QSharedPointer<qtng::SocketChannel> channel);
 private:
-    void setupChannel(QSharedPointer<qtng::SocketLike> request, QSharedPointer<qtng::SocketChannel> channel);
+    bool handleHeader(QSharedPointer<qtng::SocketLike> request, const QByteArray &rpcHeader);
+    void addRawSocket(const QByteArray &connectionId, QSharedPointer<qtng::SocketLike> request);
+    QSharedPointer<qtng::SocketLike> dropOldestRawSocket();
 public:
     QMap<QByteArray, RawSocket> rawConnections;
+    QMap<QByteArray, RawSocket> idleRawConnections;
+    QMutex rawConnectionsLock;
     QPointer<Rpc> rpc;
 };
 
@@ -59,6 +80,8 @@ public:
 public:
     virtual QString name() const override;
     virtual bool canHandle(const QString &address) override;
+    virtual bool canReusePort() const override;
+    virtual bool isPlain() const override;
 protected:
     virtual QSharedPointer<qtng::SocketLike> createConnection(const QString &address, const QString &host, quint16 port,
                                                               QSharedPointer<qtng::SocketDnsCache> dnsCache) override;
@@ -79,6 +102,7 @@ public:
 public:
     virtual QString name() const override;
     virtual bool canHandle(const QString &address) override;
+    virtual bool isPlain() const override;
 protected:
     virtual QSharedPointer<qtng::SocketLike> createConnection(const QString &address, const QString &host, quint16 port,
                                                               QSharedPointer<qtng::SocketDnsCache> dnsCache) override;
@@ -99,6 +123,8 @@ public:
 public:
     virtual QString name() const override;
     virtual bool canHandle(const QString &address) override;
+    virtual bool canReusePort() const override;
+    virtual bool isPlain() const override;
 protected:
     virtual QSharedPointer<qtng::SocketLike> createConnection(const QString &address, const QString &host, quint16 port,
                                                               QSharedPointer<qtng::SocketDnsCache> dnsCache) override;
@@ -117,6 +143,8 @@ public:
 public:
     virtual QString name() const override;
     virtual bool canHandle(const QString &address) override;
+    virtual bool canReusePort() const override;
+    virtual bool isPlain() const override;
 protected:
     virtual QSharedPointer<qtng::SocketLike> createConnection(const QString &address, const QString &host, quint16 port,
                                                               QSharedPointer<qtng::SocketDnsCache> dnsCache) override;
@@ -190,6 +218,81 @@ public:
     qtng::SslConfiguration sslConfig;
 };
 
+// unix:///path/to.sock, the peer has properties peer_pid, peer_uid and peer_gid.
+class UnixTransport : public Transport
+{
+public:
+    explicit UnixTransport(QPointer<Rpc> rpc)
+        : Transport(rpc)
+    {
+    }
+public:
+    virtual QString name() const override;
+    virtual bool canHandle(const QString &address) override;
+    virtual bool isPlain() const override;
+    virtual bool startServer(const QString &address) override;
+protected:
+    virtual QSharedPointer<qtng::SocketLike> createConnection(const QString &address, const QString &host, quint16 port,
+                                                              QSharedPointer<qtng::SocketDnsCache> dnsCache) override;
+    virtual QSharedPointer<qtng::BaseStreamServer> createServer(const QString &address, const qtng::HostAddress &host,
+                                                                quint16 port) override;
+    virtual QString getAddressTemplate() override;
+    virtual QString getPeerAddress(QSharedPointer<qtng::SocketLike> request) override;
+    virtual bool parseAddress(const QString &address, QString &host, quint16 &port) override;
+    virtual void setupChannel(QSharedPointer<qtng::SocketLike> request,
+                              QSharedPointer<qtng::SocketChannel> channel) override;
+    virtual QSharedPointer<qtng::SocketLike> prepareRequest(QSharedPointer<qtng::SocketLike> request);
+};
+
+// shm://name listens on a bootstrap unix socket in the temporary directory, and then moves the data to shared memory.
+class ShmTransport : public UnixTransport
+{
+public:
+    explicit ShmTransport(QPointer<Rpc> rpc)
+        : UnixTransport(rpc)
+    {
+    }
+public:
+    virtual QString name() const override;
+    virtual bool canHandle(const QString &address) override;
+    virtual bool isPlain() const override;
+protected:
+    virtual QSharedPointer<qtng::SocketLike> createConnection(const QString &address, const QString &host, quint16 port,
+                                                              QSharedPointer<qtng::SocketDnsCache> dnsCache) override;
+    virtual QString getAddressTemplate() override;
+    virtual QString getPeerAddress(QSharedPointer<qtng::SocketLike> request) override;
+    virtual bool parseAddress(const QString &address, QString &host, quint16 &port) override;
+    virtual void setupChannel(QSharedPointer<qtng::SocketLike> request,
+                              QSharedPointer<qtng::SocketChannel> channel) override;
+    virtual QSharedPointer<qtng::SocketLike> prepareRequest(QSharedPointer<qtng::SocketLike> request) override;
+};
+
+// inproc://name connects two rpc living in the same thread. the peers are linked to each other, and pass the
+// request and response objects without serialization. use-stream calls still go through the socket pair.
+class InprocTransport : public Transport
+{
+public:
+    explicit InprocTransport(QPointer<Rpc> rpc)
+        : Transport(rpc)
+    {
+    }
+public:
+    virtual QString name() const override;
+    virtual bool canHandle(const QString &address) override;
+    virtual bool startServer(const QString &address) override;
+    virtual bool canDispatch() const override;
+protected:
+    virtual QSharedPointer<qtng::SocketLike> createConnection(const QString &address, const QString &host, quint16 port,
+                                                              QSharedPointer<qtng::SocketDnsCache> dnsCache) override;
+    virtual QSharedPointer<qtng::BaseStreamServer> createServer(const QString &address, const qtng::HostAddress &host,
+                                                                quint16 port) override;
+    virtual QString getAddressTemplate() override;
+    virtual QString getPeerAddress(QSharedPointer<qtng::SocketLike> request) override;
+    virtual bool parseAddress(const QString &address, QString &host, quint16 &port) override;
+    virtual void setupChannel(QSharedPointer<qtng::SocketLike> request,
+                              QSharedPointer<qtng::SocketChannel> channel) override;
+};
+
 END_LAFRPC_NAMESPACE
 
 #endif  // LAFRPC_TRANSPORT_H
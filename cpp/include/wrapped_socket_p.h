@@ -0,0 +1,88 @@
+#ifndef LAFRPC_WRAPPED_SOCKET_P_H
+#define LAFRPC_WRAPPED_SOCKET_P_H
+
+#include <functional>
+#include "qtnetworkng.h"
+#include "utils.h"
+
+BEGIN_LAFRPC_NAMESPACE
+
+// forward everything to the backend socket, the subclasses override what they change.
+class WrappedSocket : public qtng::SocketLike
+{
+public:
+    explicit WrappedSocket(QSharedPointer<qtng::SocketLike> backend);
+    virtual ~WrappedSocket() override;
+public:
+    virtual qtng::Socket::SocketError error() const override;
+    virtual QString errorString() const override;
+    virtual bool isValid() const override;
+    virtual qtng::HostAddress localAddress() const override;
+    virtual quint16 localPort() const override;
+    virtual qtng::HostAddress peerAddress() const override;
+    virtual QString peerName() const override;
+    virtual quint16 peerPort() const override;
+    virtual qintptr fileno() const override;
+    virtual qtng::Socket::SocketType type() const override;
+    virtual qtng::Socket::SocketState state() const override;
+    virtual qtng::HostAddress::NetworkLayerProtocol protocol() const override;
+
+    virtual qtng::Socket *acceptRaw() override;
+    virtual QSharedPointer<qtng::SocketLike> accept() override;
+    virtual bool bind(const qtng::HostAddress &address, quint16 port = 0,
+                      qtng::Socket::BindMode mode = qtng::Socket::DefaultForPlatform) override;
+    virtual bool bind(quint16 port = 0, qtng::Socket::BindMode mode = qtng::Socket::DefaultForPlatform) override;
+    virtual bool connect(const qtng::HostAddress &addr, quint16 port) override;
+    virtual bool connect(
+            const QString &hostName, quint16 port,
+            QSharedPointer<qtng::SocketDnsCache> dnsCache = QSharedPointer<qtng::SocketDnsCache>()) override;
+    virtual void close() override;
+    virtual void abort() override;
+    virtual bool listen(int backlog) override;
+    virtual bool setOption(qtng::Socket::SocketOption option, const QVariant &value) override;
+    virtual QVariant option(qtng::Socket::SocketOption option) const override;
+
+    virtual qint32 peek(char *data, qint32 size) override;
+    virtual qint32 peekRaw(char *data, qint32 size) override;
+    virtual qint32 recv(char *data, qint32 size) override;
+    virtual qint32 recvall(char *data, qint32 size) override;
+    virtual qint32 send(const char *data, qint32 size) override;
+    virtual qint32 sendall(const char *data, qint32 size) override;
+    virtual QByteArray recv(qint32 size) override;
+    virtual QByteArray recvall(qint32 size) override;
+    virtual qint32 send(const QByteArray &data) override;
+    virtual qint32 sendall(const QByteArray &data) override;
+public:
+    QSharedPointer<qtng::SocketLike> backend;
+};
+
+// marks the tcp or unix socket without encryption, so sendfile() and splice() can use its fileno() directly.
+class PlainSocket : public WrappedSocket
+{
+public:
+    explicit PlainSocket(QSharedPointer<qtng::SocketLike> backend);
+public:
+    static QSharedPointer<qtng::SocketLike> wrap(QSharedPointer<qtng::SocketLike> socket);
+    // the fileno of the plain socket under the wrappers, or -1.
+    static qintptr plainFileno(QSharedPointer<qtng::SocketLike> socket);
+};
+
+// a raw socket goes back to its pool instead of closing, if the transfer on it is finished cleanly.
+class RecyclableSocket : public WrappedSocket
+{
+public:
+    typedef std::function<void(QSharedPointer<qtng::SocketLike>)> Recycler;
+    RecyclableSocket(QSharedPointer<qtng::SocketLike> backend, const Recycler &recycler);
+    virtual ~RecyclableSocket() override;
+public:
+    virtual void close() override;
+    virtual void abort() override;
+    static void markReusable(QSharedPointer<qtng::SocketLike> socket);
+private:
+    Recycler recycler;
+    bool reusable;
+};
+
+END_LAFRPC_NAMESPACE
+
+#endif  // LAFRPC_WRAPPED_SOCKET_P_H
@@ -0,0 +1,55 @@
+#ifndef LAFRPC_ZEROCOPY_P_H
+#define LAFRPC_ZEROCOPY_P_H
+
+#include <QtCore/qfile.h>
+#include "qtnetworkng.h"
+#include "utils.h"
+
+BEGIN_LAFRPC_NAMESPACE
+
+// move the file content in the kernel, the socket must be non-blocking and not encrypted.
+struct ZeroCopy
+{
+    // send `count` bytes of the file from `offset` without changing the file position. return -1 if the kernel can
+    // not do it for these descriptors and nothing is sent, so the caller can fall back to read() and send().
+    static qint64 sendfile(qintptr fileFd, qint64 offset, qintptr socketFd, qint64 count);
+    // receive `count` bytes from the socket and write them to the file at `offset` through a pipe. return -1 if the
+    // kernel can not do it and nothing is received.
+    static qint64 splice(qintptr socketFd, qintptr fileFd, qint64 offset, qint64 count);
+    // reserve the disk blocks of [offset, size) but keep the file size, so the resuming still sees the real bytes.
+    static void preallocate(qintptr fileFd, qint64 offset, qint64 size);
+    // the next packet of file, a slice of the mapping or a fresh buffer that the channel takes without copying.
+    // return empty if the file is broken or ends.
+    static QByteArray readPacket(qtng::FileLike *f, qint32 size);
+};
+
+// read the file from its memory mapping, so the peers sending the same file share the page cache.
+class MappedFile : public qtng::FileLike
+{
+public:
+    // return null if the file is small or can not be mapped, use FileLike::rawFile() instead.
+    static QSharedPointer<MappedFile> map(QSharedPointer<QFile> file);
+    virtual ~MappedFile() override;
+public:
+    virtual qint32 read(char *data, qint32 size) override;
+    virtual qint32 write(const char *data, qint32 size) override;
+    virtual void close() override;
+    virtual qint64 size() override;
+public:
+    // the next bytes without copying. it is valid while the file is mapped, and the channels copy it into their
+    // frames before sendPacket() returns.
+    QByteArray slice(qint32 size);
+    bool seek(qint64 pos);
+private:
+    MappedFile(QSharedPointer<QFile> file, uchar *data, qint64 length);
+    void advise(qint64 newPos);
+private:
+    QSharedPointer<QFile> file;
+    uchar *data;
+    qint64 length;
+    qint64 pos;
+};
+
+END_LAFRPC_NAMESPACE
+
+#endif  // LAFRPC_ZEROCOPY_P_H
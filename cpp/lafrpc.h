@@ -8,5 +8,6 @@
 #include "include/transport.h"
 #include "include/sendfile.h"
 #include "include/senddir.h"
+#include "include/chunkstore.h"
 
 #endif
@@ -1,11 +1,21 @@
 QT += core network
 CONFIG += c++11
+unix:!macx: LIBS += -lrt
 
 SOURCES += $$PWD/src/peer.cpp \
     $$PWD/src/rpc.cpp \
     $$PWD/src/serialization.cpp \
     $$PWD/src/base.cpp \
     $$PWD/src/transport.cpp \
+    $$PWD/src/shard.cpp \
+    $$PWD/src/handshake.cpp \
+    $$PWD/src/resolver.cpp \
+    $$PWD/src/shm.cpp \
+    $$PWD/src/coalescing.cpp \
+    $$PWD/src/wrapped_socket.cpp \
+    $$PWD/src/delta.cpp \
+    $$PWD/src/chunkstore.cpp \
+    $$PWD/src/zerocopy.cpp \
     $$PWD/src/tran_crypto.cpp
 
 HEADERS += $$PWD/lafrpc.h \
@@ -16,6 +26,13 @@ HEADERS += $$PWD/lafrpc.h \
     $$PWD/include/base.h \
     $$PWD/include/transport.h \
     $$PWD/include/rpc_p.h \
+    $$PWD/include/shm_p.h \
+    $$PWD/include/coalescing_p.h \
+    $$PWD/include/wrapped_socket_p.h \
+    $$PWD/include/delta_p.h \
+    $$PWD/include/chunkstore.h \
+    $$PWD/include/chunkstore_p.h \
+    $$PWD/include/zerocopy_p.h \
     $$PWD/include/tran_crypto.h
 
 include(qtnetworkng/qtnetworkng.pri)
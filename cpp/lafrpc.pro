@@ -4,6 +4,8 @@ CONFIG += console
 QT = core network
 #CONFIG -= app_bundle
 SOURCES = tests/simple_test.cpp \
-    tests/sendfile.cpp
+    tests/sendfile.cpp \
+    tests/transfer.cpp \
+    tests/transports.cpp
 
 include(lafrpc.pri)
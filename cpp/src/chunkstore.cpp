@@ -0,0 +1,354 @@
+#include <QtCore/qcryptographichash.h>
+#include <QtCore/qdatetime.h>
+#include <QtCore/qdiriterator.h>
+#include <QtCore/qendian.h>
+#include <QtCore/qfileinfo.h>
+#include <QtCore/qloggingcategory.h>
+#include <QtCore/qmap.h>
+#include "../include/chunkstore_p.h"
+
+static Q_LOGGING_CATEGORY(logger, "lafrpc.chunkstore");
+
+using namespace qtng;
+
+BEGIN_LAFRPC_NAMESPACE
+
+RpcChunkStore::~RpcChunkStore() { }
+
+NativeRpcChunkStore::NativeRpcChunkStore(const QString &root, quint64 capacity)
+    : rootDir(root)
+    , capacity(capacity)
+    , used(0)
+{
+    rootDir.makeAbsolute();
+    load();
+}
+
+QString NativeRpcChunkStore::makePath(const QByteArray &hash) const
+{
+    const QString &name = QString::fromLatin1(hash.toHex());
+    return rootDir.filePath(name.left(2) + QLatin1Char('/') + name);
+}
+
+void NativeRpcChunkStore::load()
+{
+    if (!rootDir.exists() && !rootDir.mkpath(QString::fromLatin1("."))) {
+        qCWarning(logger) << "can not create chunk store:" << rootDir.path();
+        return;
+    }
+    QMultiMap<QDateTime, Entry> found;
+    QDirIterator itor(rootDir.path(), QDir::Files, QDirIterator::Subdirectories);
+    while (itor.hasNext()) {
+        itor.next();
+        const QFileInfo &fileInfo = itor.fileInfo();
+        // skip the temporary files.
+        if (fileInfo.fileName().size() != 64) {
+            continue;
+        }
+        const QByteArray &hash = QByteArray::fromHex(fileInfo.fileName().toLatin1());
+        Entry entry;
+        entry.hash = hash;
+        entry.size = static_cast<quint64>(fileInfo.size());
+        found.insert(fileInfo.lastModified(), entry);
+    }
+    // the map is sorted from old to new.
+    for (QMultiMap<QDateTime, Entry>::const_iterator itor = found.constBegin(); itor != found.constEnd(); ++itor) {
+        lru.push_front(itor.value());
+        entries.insert(itor.value().hash, lru.begin());
+        used += itor.value().size;
+    }
+    evict();
+}
+
+QByteArray NativeRpcChunkStore::get(const QByteArray &hash)
+{
+    QMutexLocker locker(&mutex);
+    QHash<QByteArray, std::list<Entry>::iterator>::iterator itor = entries.find(hash);
+    if (itor == entries.end()) {
+        return QByteArray();
+    }
+    QFile f(makePath(hash));
+    if (!f.open(QIODevice::ReadOnly)) {
+        remove(hash);
+        return QByteArray();
+    }
+    const QByteArray &data = f.readAll();
+    if (QCryptographicHash::hash(data, QCryptographicHash::Sha256) != hash) {
+        qCDebug(logger) << "remove broken chunk:" << hash.toHex();
+        f.close();
+        remove(hash);
+        return QByteArray();
+    }
+    lru.splice(lru.begin(), lru, itor.value());
+    return data;
+}
+
+bool NativeRpcChunkStore::put(const QByteArray &hash, const QByteArray &data)
+{
+    QMutexLocker locker(&mutex);
+    if (entries.contains(hash)) {
+        lru.splice(lru.begin(), lru, entries.value(hash));
+        return true;
+    }
+    if (static_cast<quint64>(data.size()) > capacity) {
+        return false;
+    }
+    const QString &path = makePath(hash);
+    if (!rootDir.mkpath(QFileInfo(path).path())) {
+        return false;
+    }
+    // write to a temporary file first, so a crash never leaves a partial chunk.
+    const QString &tempPath = path + QString::fromLatin1(".tmp");
+    QFile f(tempPath);
+    if (!f.open(QIODevice::WriteOnly) || f.write(data) != data.size()) {
+        qCDebug(logger) << "can not write chunk:" << tempPath;
+        f.remove();
+        return false;
+    }
+    f.close();
+    if (!QFile::rename(tempPath, path)) {
+        QFile::remove(tempPath);
+        return false;
+    }
+    Entry entry;
+    entry.hash = hash;
+    entry.size = static_cast<quint64>(data.size());
+    lru.push_front(entry);
+    entries.insert(hash, lru.begin());
+    used += entry.size;
+    evict();
+    return true;
+}
+
+quint64 NativeRpcChunkStore::usedBytes() const
+{
+    QMutexLocker locker(&mutex);
+    return used;
+}
+
+void NativeRpcChunkStore::remove(const QByteArray &hash)
+{
+    QHash<QByteArray, std::list<Entry>::iterator>::iterator itor = entries.find(hash);
+    if (itor == entries.end()) {
+        return;
+    }
+    used -= itor.value()->size;
+    lru.erase(itor.value());
+    entries.erase(itor);
+    QFile::remove(makePath(hash));
+}
+
+void NativeRpcChunkStore::evict()
+{
+    while (used > capacity && !lru.empty()) {
+        remove(lru.back().hash);
+    }
+}
+
+struct GearTable
+{
+    GearTable()
+    {
+        // splitmix64 with a fixed seed.
+        quint64 seed = 0x6c6166727063ULL;
+        for (int i = 0; i < 256; ++i) {
+            seed += 0x9e3779b97f4a7c15ULL;
+            quint64 z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            values[i] = z ^ (z >> 31);
+        }
+    }
+    quint64 values[256];
+};
+
+int FastCdc::cut(const char *data, int size)
+{
+    if (size <= MinSize) {
+        return size;
+    }
+    static const GearTable gear;
+    // the left shift moves the old bytes to the high bits, so the masks check the high bits. the harder mask before
+    // the average size and the easier one after it make the chunk sizes close to the average.
+    const quint64 maskS = 0xffffc00000000000ULL;  // 18 bits
+    const quint64 maskL = 0xfffc000000000000ULL;  // 14 bits
+    const int normal = qMin(size, AverageSize);
+    const int limit = qMin(size, MaxSize);
+    quint64 fp = 0;
+    int i = MinSize;
+    for (; i < normal; ++i) {
+        fp = (fp << 1) + gear.values[static_cast<uchar>(data[i])];
+        if (!(fp & maskS)) {
+            return i + 1;
+        }
+    }
+    for (; i < limit; ++i) {
+        fp = (fp << 1) + gear.values[static_cast<uchar>(data[i])];
+        if (!(fp & maskL)) {
+            return i + 1;
+        }
+    }
+    return limit;
+}
+
+bool ChunkedTransfer::send(QSharedPointer<FileLike> f, quint64 size, const Sender &sendFrame,
+                           const Receiver &recvFrame, const Progress &progress, QByteArray *hash)
+{
+    const qint64 readSize = 1024 * 64;
+    QCryptographicHash hasher(QCryptographicHash::Sha256);
+    QByteArray data;
+    quint64 count = 0;
+    while (true) {
+        QList<QByteArray> chunks;
+        QByteArray header("H");
+        while (chunks.size() < BatchSize) {
+            while (data.size() < FastCdc::MaxSize && count < size) {
+                const int old = data.size();
+                const qint64 want = qMin<qint64>(readSize, static_cast<qint64>(size - count));
+                data.resize(old + static_cast<int>(want));
+                qint64 readBytes = f->read(data.data() + old, want);
+                if (readBytes <= 0) {
+                    qCWarning(logger) << "rpc file read error.";
+                    return false;
+                }
+                data.resize(old + static_cast<int>(readBytes));
+                hasher.addData(data.constData() + old, static_cast<int>(readBytes));
+                count += static_cast<quint64>(readBytes);
+            }
+            if (data.isEmpty()) {
+                break;
+            }
+            const int n = FastCdc::cut(data.constData(), data.size());
+            const QByteArray chunk = data.left(n);
+            data.remove(0, n);
+            char chunkSize[4];
+            qToBigEndian<quint32>(static_cast<quint32>(n), reinterpret_cast<uchar *>(chunkSize));
+            header.append(QCryptographicHash::hash(chunk, QCryptographicHash::Sha256));
+            header.append(chunkSize, 4);
+            chunks.append(chunk);
+        }
+        if (chunks.isEmpty()) {
+            break;
+        }
+        if (!sendFrame(header)) {
+            return false;
+        }
+        const QByteArray &stored = recvFrame();
+        if (stored.size() != chunks.size()) {
+            qCDebug(logger) << "got invalid chunk list.";
+            return false;
+        }
+        qint64 bs = 0;
+        for (int i = 0; i < chunks.size(); ++i) {
+            if (stored.at(i) == 0 && !sendFrame(chunks.at(i))) {
+                return false;
+            }
+            bs += chunks.at(i).size();
+        }
+        if (progress && !progress(bs)) {
+            return false;
+        }
+    }
+    *hash = hasher.result();
+    return sendFrame(QByteArray("E") + *hash);
+}
+
+bool ChunkedTransfer::recv(QSharedPointer<FileLike> f, quint64 size, QSharedPointer<RpcChunkStore> store,
+                           const Sender &sendFrame, const Receiver &recvFrame, const Progress &progress,
+                           QByteArray *hash)
+{
+    const int entrySize = 32 + 4;
+    QCryptographicHash hasher(QCryptographicHash::Sha256);
+    quint64 count = 0;
+    while (true) {
+        const QByteArray &header = recvFrame();
+        if (header.isEmpty()) {
+            qCWarning(logger) << "rpc file receiving error.";
+            return false;
+        }
+        if (header.at(0) == 'E') {
+            if (header.size() != 33 || count != size || hasher.result() != header.mid(1)) {
+                qCDebug(logger) << "writeTo() got mismatched hash.";
+                return false;
+            }
+            *hash = header.mid(1);
+            return true;
+        }
+        if (header.at(0) != 'H' || header.size() == 1 || (header.size() - 1) % entrySize != 0) {
+            qCDebug(logger) << "got invalid chunk list.";
+            return false;
+        }
+        const int n = (header.size() - 1) / entrySize;
+        QList<QByteArray> hashes;
+        QVector<quint32> sizes;
+        QVector<QByteArray> chunks(n);
+        QByteArray stored(n, '\0');
+        for (int i = 0; i < n; ++i) {
+            const char *p = header.constData() + 1 + i * entrySize;
+            const quint32 chunkSize = qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(p + 32));
+            if (chunkSize == 0 || chunkSize > static_cast<quint32>(FastCdc::MaxSize)) {
+                qCDebug(logger) << "got invalid chunk list.";
+                return false;
+            }
+            hashes.append(QByteArray(p, 32));
+            sizes.append(chunkSize);
+        }
+        if (!store.isNull()) {
+            // the store reads files and checks their hashes, so look up the whole batch in a thread. keep the stored
+            // chunks now, they may be evicted by the chunks received later.
+            chunks = callInThread<QVector<QByteArray>>([store, hashes]() -> QVector<QByteArray> {
+                QVector<QByteArray> found;
+                for (const QByteArray &chunkHash : hashes) {
+                    found.append(store->get(chunkHash));
+                }
+                return found;
+            });
+            for (int i = 0; i < n; ++i) {
+                if (chunks.at(i).size() == static_cast<int>(sizes.at(i))) {
+                    stored[i] = 1;
+                } else {
+                    chunks[i].clear();
+                }
+            }
+        }
+        if (!sendFrame(stored)) {
+            return false;
+        }
+        qint64 bs = 0;
+        QList<QPair<QByteArray, QByteArray>> received;
+        for (int i = 0; i < n; ++i) {
+            if (stored.at(i) == 0) {
+                const QByteArray &data = recvFrame();
+                if (QCryptographicHash::hash(data, QCryptographicHash::Sha256) != hashes.at(i)) {
+                    qCDebug(logger) << "got broken chunk.";
+                    return false;
+                }
+                chunks[i] = data;
+                if (!store.isNull()) {
+                    received.append(qMakePair(hashes.at(i), data));
+                }
+            }
+            const QByteArray &chunk = chunks.at(i);
+            if (count + static_cast<quint64>(chunk.size()) > size || f->write(chunk) != chunk.size()) {
+                qCWarning(logger) << "rpc file write error.";
+                return false;
+            }
+            hasher.addData(chunk);
+            count += static_cast<quint64>(chunk.size());
+            bs += chunk.size();
+        }
+        if (!received.isEmpty()) {
+            callInThread<bool>([store, received]() -> bool {
+                for (const QPair<QByteArray, QByteArray> &chunk : received) {
+                    store->put(chunk.first, chunk.second);
+                }
+                return true;
+            });
+        }
+        if (progress && !progress(bs)) {
+            return false;
+        }
+    }
+}
+
+END_LAFRPC_NAMESPACE
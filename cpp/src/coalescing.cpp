@@ -0,0 +1,243 @@
+#include <QtCore/qloggingcategory.h>
+#include "../include/coalescing_p.h"
+
+static Q_LOGGING_CATEGORY(logger, "lafrpc.coalescing");
+
+using namespace qtng;
+
+BEGIN_LAFRPC_NAMESPACE
+
+CoalescingSocket::CoalescingSocket(QSharedPointer<SocketLike> backend, quint32 maxBytes, quint32 maxDelay)
+    : WrappedSocket(backend)
+    , operations(new CoroutineGroup())
+    , maxBytes(maxBytes)
+    , maxDelay(maxDelay)
+    , flushing(false)
+    , broken(false)
+{
+}
+
+CoalescingSocket::~CoalescingSocket()
+{
+    delete operations;
+}
+
+bool CoalescingSocket::flush()
+{
+    if (!writing.acquire()) {
+        return false;
+    }
+    Cleaner cleaner([this] { writing.release(); });
+    Q_UNUSED(cleaner);
+    return writeBuffer();
+}
+
+// the caller holds the writing lock.
+bool CoalescingSocket::writeBuffer()
+{
+    if (buffer.isEmpty()) {
+        return !broken;
+    }
+    // new packets go to a fresh buffer while this one is written. it is allocated by the next append(), so idle
+    // peers pin no memory.
+    QByteArray data;
+    data.swap(buffer);
+    if (broken || backend->sendall(data) != data.size()) {
+        qCDebug(logger) << "can not write coalesced packets:" << backend->errorString();
+        broken = true;
+        return false;
+    }
+    return true;
+}
+
+// at low load there is only one packet when the flusher wakes up, so it is written at the end of the same tick.
+void CoalescingSocket::flushLater()
+{
+    while (true) {
+        Coroutine::msleep(maxDelay);
+        if (!flush() || buffer.isEmpty()) {
+            break;
+        }
+    }
+    flushing = false;
+}
+
+qint32 CoalescingSocket::sendall(const char *data, qint32 size)
+{
+    if (broken) {
+        return -1;
+    }
+    if (size <= 0) {
+        return 0;
+    }
+    if (static_cast<quint32>(buffer.size()) + static_cast<quint32>(size) > maxBytes) {
+        if (!flush()) {
+            return -1;
+        }
+        if (static_cast<quint32>(size) >= maxBytes) {
+            // the large packet gains nothing from the buffer.
+            if (!writing.acquire()) {
+                return -1;
+            }
+            qint32 sentBytes = backend->sendall(data, size);
+            writing.release();
+            if (sentBytes != size) {
+                broken = true;
+            }
+            return sentBytes;
+        }
+    }
+    if (buffer.isEmpty()) {
+        buffer.reserve(static_cast<int>(maxBytes));
+    }
+    buffer.append(data, size);
+    if (!flushing) {
+        flushing = true;
+        operations->spawn([this] { flushLater(); });
+    }
+    return size;
+}
+
+qint32 CoalescingSocket::send(const char *data, qint32 size)
+{
+    return sendall(data, size);
+}
+
+qint32 CoalescingSocket::send(const QByteArray &data)
+{
+    return sendall(data.constData(), data.size());
+}
+
+qint32 CoalescingSocket::sendall(const QByteArray &data)
+{
+    return sendall(data.constData(), data.size());
+}
+
+bool CoalescingSocket::isValid() const
+{
+    return !broken && backend->isValid();
+}
+
+void CoalescingSocket::close()
+{
+    // wait for the flush in progress, or the batch half written would be followed by the newer packets. then the
+    // flusher is sleeping or waiting for the lock, and can be killed.
+    if (writing.acquire()) {
+        operations->killall();
+        flushing = false;
+        writeBuffer();
+        writing.release();
+    } else {
+        operations->killall();
+        flushing = false;
+    }
+    backend->close();
+}
+
+void CoalescingSocket::abort()
+{
+    operations->killall();
+    buffer.clear();
+    broken = true;
+    backend->abort();
+}
+
+BufferedReadSocket::BufferedReadSocket(QSharedPointer<SocketLike> backend, quint32 bufferSize)
+    : WrappedSocket(backend)
+    , position(0)
+    , bufferSize(bufferSize)
+{
+}
+
+// the buffer is allocated only while it holds data, so idle peers pin no memory.
+qint32 BufferedReadSocket::fill()
+{
+    buffer.resize(static_cast<int>(bufferSize));
+    position = 0;
+    qint32 receivedBytes = backend->recv(buffer.data(), buffer.size());
+    if (receivedBytes <= 0) {
+        buffer.clear();
+        return receivedBytes;
+    }
+    buffer.resize(receivedBytes);
+    return receivedBytes;
+}
+
+qint32 BufferedReadSocket::take(char *data, qint32 size)
+{
+    qint32 bytes = qMin(size, buffer.size() - position);
+    memcpy(data, buffer.constData() + position, static_cast<size_t>(bytes));
+    position += bytes;
+    if (position >= buffer.size()) {
+        buffer.clear();
+        position = 0;
+    }
+    return bytes;
+}
+
+qint32 BufferedReadSocket::recv(char *data, qint32 size)
+{
+    if (size <= 0) {
+        return 0;
+    }
+    if (buffer.isEmpty()) {
+        if (static_cast<quint32>(size) >= bufferSize) {
+            // the large read gains nothing from the buffer.
+            return backend->recv(data, size);
+        }
+        qint32 receivedBytes = fill();
+        if (receivedBytes <= 0) {
+            return receivedBytes;
+        }
+    }
+    return take(data, size);
+}
+
+qint32 BufferedReadSocket::recvall(char *data, qint32 size)
+{
+    qint32 total = 0;
+    while (total < size) {
+        qint32 receivedBytes = recv(data + total, size - total);
+        if (receivedBytes <= 0) {
+            return total > 0 ? total : receivedBytes;
+        }
+        total += receivedBytes;
+    }
+    return total;
+}
+
+QByteArray BufferedReadSocket::recv(qint32 size)
+{
+    QByteArray data(qMax(0, size), Qt::Uninitialized);
+    qint32 receivedBytes = recv(data.data(), data.size());
+    data.resize(qMax(0, receivedBytes));
+    return data;
+}
+
+QByteArray BufferedReadSocket::recvall(qint32 size)
+{
+    QByteArray data(qMax(0, size), Qt::Uninitialized);
+    qint32 receivedBytes = recvall(data.data(), data.size());
+    data.resize(qMax(0, receivedBytes));
+    return data;
+}
+
+qint32 BufferedReadSocket::peek(char *data, qint32 size)
+{
+    if (buffer.isEmpty()) {
+        return backend->peek(data, size);
+    }
+    qint32 bytes = qMin(size, buffer.size() - position);
+    memcpy(data, buffer.constData() + position, static_cast<size_t>(qMax(0, bytes)));
+    return bytes;
+}
+
+qint32 BufferedReadSocket::peekRaw(char *data, qint32 size)
+{
+    if (buffer.isEmpty()) {
+        return backend->peekRaw(data, size);
+    }
+    return peek(data, size);
+}
+
+END_LAFRPC_NAMESPACE
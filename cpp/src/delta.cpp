@@ -0,0 +1,135 @@
+#include <QtCore/qcryptographichash.h>
+#include <QtCore/qendian.h>
+#include <QtCore/qfile.h>
+#include <QtCore/qloggingcategory.h>
+#include <QtCore/qmath.h>
+#include <string.h>
+#include "../include/delta_p.h"
+
+static Q_LOGGING_CATEGORY(logger, "lafrpc.delta");
+
+BEGIN_LAFRPC_NAMESPACE
+
+RollingChecksum::RollingChecksum()
+    : a(0)
+    , b(0)
+    , length(0)
+{
+}
+
+void RollingChecksum::reset(const char *data, quint32 length)
+{
+    this->length = length;
+    a = 0;
+    b = 0;
+    for (quint32 i = 0; i < length; ++i) {
+        const quint32 c = static_cast<uchar>(data[i]);
+        a += c;
+        b += (length - i) * c;
+    }
+}
+
+void RollingChecksum::roll(uchar out, uchar in)
+{
+    a = a - out + in;
+    b = b - length * out + a;
+}
+
+DeltaSignatures::DeltaSignatures()
+    : blockSize(0)
+{
+}
+
+quint32 DeltaSignatures::chooseBlockSize(quint64 fileSize)
+{
+    const quint32 blockSize = static_cast<quint32>(qSqrt(static_cast<qreal>(fileSize))) & ~static_cast<quint32>(63);
+    if (blockSize < MinBlockSize) {
+        return MinBlockSize;
+    } else if (blockSize > MaxBlockSize) {
+        return MaxBlockSize;
+    }
+    return blockSize;
+}
+
+bool DeltaSignatures::isValid(quint32 blockSize, quint32 count)
+{
+    return blockSize >= MinBlockSize && blockSize <= MaxBlockSize && count <= MaxCount;
+}
+
+QByteArray DeltaSignatures::strongHash(const char *data, int size)
+{
+    return QCryptographicHash::hash(QByteArray::fromRawData(data, size), QCryptographicHash::Md5);
+}
+
+DeltaSignatures DeltaSignatures::calculate(const QString &filePath)
+{
+    DeltaSignatures signatures;
+    QFile f(filePath);
+    if (!f.open(QIODevice::ReadOnly)) {
+        return signatures;
+    }
+    signatures.blockSize = chooseBlockSize(static_cast<quint64>(f.size()));
+    QByteArray buf(static_cast<int>(signatures.blockSize), Qt::Uninitialized);
+    RollingChecksum checksum;
+    // the last partial block is sent as literal data.
+    while (f.read(buf.data(), buf.size()) == buf.size()) {
+        checksum.reset(buf.constData(), signatures.blockSize);
+        signatures.blocks.insert(checksum.value(), static_cast<quint32>(signatures.weak.size()));
+        signatures.weak.append(checksum.value());
+        signatures.strong.append(strongHash(buf.constData(), buf.size()));
+    }
+    return signatures;
+}
+
+QByteArray DeltaSignatures::save() const
+{
+    QByteArray data(weak.size() * EntrySize, Qt::Uninitialized);
+    char *p = data.data();
+    for (int i = 0; i < weak.size(); ++i) {
+        qToBigEndian<quint32>(weak.at(i), reinterpret_cast<uchar *>(p));
+        memcpy(p + 4, strong.at(i).constData(), 16);
+        p += EntrySize;
+    }
+    return data;
+}
+
+bool DeltaSignatures::restore(quint32 blockSize, quint32 count, const QByteArray &data)
+{
+    if (!isValid(blockSize, count) || static_cast<qint64>(data.size()) != static_cast<qint64>(count) * EntrySize) {
+        qCDebug(logger) << "got invalid delta signatures.";
+        return false;
+    }
+    this->blockSize = blockSize;
+    weak.clear();
+    strong.clear();
+    blocks.clear();
+    weak.reserve(static_cast<int>(count));
+    strong.reserve(static_cast<int>(count));
+    const char *p = data.constData();
+    for (quint32 i = 0; i < count; ++i) {
+        const quint32 value = qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(p));
+        blocks.insert(value, i);
+        weak.append(value);
+        strong.append(QByteArray(p + 4, 16));
+        p += EntrySize;
+    }
+    return true;
+}
+
+qint64 DeltaSignatures::find(quint32 weak, const char *data) const
+{
+    QMultiHash<quint32, quint32>::const_iterator itor = blocks.constFind(weak);
+    if (itor == blocks.constEnd()) {
+        return -1;
+    }
+    // only compute the strong hash if the weak one is matched.
+    const QByteArray &hash = strongHash(data, static_cast<int>(blockSize));
+    for (; itor != blocks.constEnd() && itor.key() == weak; ++itor) {
+        if (strong.at(static_cast<int>(itor.value())) == hash) {
+            return itor.value();
+        }
+    }
+    return -1;
+}
+
+END_LAFRPC_NAMESPACE
@@ -0,0 +1,158 @@
+#include <QtCore/qloggingcategory.h>
+#include "../include/rpc_p.h"
+#ifdef Q_OS_UNIX
+#  include <sys/socket.h>
+#  include <unistd.h>
+#endif
+
+static Q_LOGGING_CATEGORY(logger, "lafrpc.handshake");
+
+BEGIN_LAFRPC_NAMESPACE
+
+class HandshakePool::Worker : public QThread
+{
+public:
+    explicit Worker(HandshakePool *pool)
+        : pool(pool)
+    {
+    }
+protected:
+    virtual void run() override { pool->work(); }
+private:
+    HandshakePool *pool;
+};
+
+HandshakePool::HandshakePool(int threads)
+    : stopping(false)
+{
+    for (int i = 0; i < threads; ++i) {
+        QThread *worker = new Worker(this);
+        workers.append(worker);
+        worker->start();
+    }
+}
+
+HandshakePool::~HandshakePool()
+{
+    {
+        QMutexLocker locker(&mutex);
+        stopping = true;
+        condition.wakeAll();
+    }
+    for (QThread *worker : workers) {
+        worker->wait();
+        delete worker;
+    }
+}
+
+bool HandshakePool::handshake(QSharedPointer<qtng::SslSocket> ssl, bool asServer)
+{
+#ifdef Q_OS_UNIX
+    releaseAbandoned();
+    // the worker writes one byte to the socket pair when the job is done, the coroutine waits in the event loop.
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        qCWarning(logger) << "can not create notifier for handshake.";
+        return false;
+    }
+    QSharedPointer<qtng::Socket> notifier(new qtng::Socket(fds[0]));
+    QSharedPointer<Job> job(new Job());
+    job->ssl = ssl;
+    job->owner = QThread::currentThread();
+    job->asServer = asServer;
+    job->running = false;
+    job->done = false;
+    job->cancelled = false;
+    job->result = false;
+    job->notifier = fds[1];
+    {
+        QMutexLocker locker(&mutex);
+        jobs.append(job);
+        condition.wakeOne();
+    }
+    // if the coroutine is killed, the queued job is skipped, and the running one is released by this thread later.
+    QSharedPointer<qtng::SslSocket> released;
+    Cleaner cleaner([this, job, notifier, &released] {
+        notifier->close();
+        QMutexLocker locker(&mutex);
+        if (!job->running || job->done) {
+            released.swap(job->ssl);
+        }
+        job->cancelled = !job->done;
+    });
+    Q_UNUSED(cleaner);
+    if (notifier->recv(1).size() != 1) {
+        return false;
+    }
+    QMutexLocker locker(&mutex);
+    return job->result;
+#else
+    return qtng::callInThread<bool>([ssl, asServer]() -> bool { return ssl->handshake(asServer); });
+#endif
+}
+
+// release the sockets of the jobs cancelled while running, in the thread that owns them.
+void HandshakePool::releaseAbandoned()
+{
+    QList<QSharedPointer<Job>> mine;
+    {
+        QMutexLocker locker(&mutex);
+        QThread *current = QThread::currentThread();
+        for (int i = abandoned.size() - 1; i >= 0; --i) {
+            if (abandoned.at(i)->owner == current) {
+                mine.append(abandoned.takeAt(i));
+            }
+        }
+    }
+    for (QSharedPointer<Job> job : mine) {
+        job->ssl.clear();
+    }
+}
+
+void HandshakePool::work()
+{
+    while (true) {
+        QSharedPointer<Job> job;
+        {
+            QMutexLocker locker(&mutex);
+            while (jobs.isEmpty() && !stopping) {
+                condition.wait(&mutex);
+            }
+            if (stopping) {
+                break;
+            }
+            job = jobs.takeFirst();
+            if (job->cancelled) {
+#ifdef Q_OS_UNIX
+                ::close(job->notifier);
+#endif
+                continue;
+            }
+            job->running = true;
+        }
+        // the job keeps a reference, so the socket lives until its owner thread releases it.
+        const bool result = job->ssl->handshake(job->asServer);
+        {
+            QMutexLocker locker(&mutex);
+            job->result = result;
+            job->done = true;
+            if (job->cancelled) {
+                abandoned.append(job);
+            }
+        }
+#ifdef Q_OS_UNIX
+        ::send(job->notifier, "\x01", 1, MSG_NOSIGNAL);
+        ::close(job->notifier);
+#endif
+    }
+    // wake the coroutines of jobs never started, they get false.
+    QMutexLocker locker(&mutex);
+    for (QSharedPointer<Job> job : jobs) {
+#ifdef Q_OS_UNIX
+        ::close(job->notifier);
+#endif
+    }
+    jobs.clear();
+}
+
+END_LAFRPC_NAMESPACE
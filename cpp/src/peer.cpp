@@ -117,12 +117,16 @@ public:
     void handleRequest(QSharedPointer<Request> request);
     QVariant lookupAndCall(const QString &methodName, const QVariantList &args, const QVariantMap &kwargs,
                            const QVariantMap &header);
+    void link(const QByteArray &linkKey);
+    PeerPrivate *linkedPeer() const;
 
     QMap<QByteArray, QSharedPointer<Waiter>> waiters;
     QString name;
     QString address;
     QSharedPointer<DataChannel> channel;
     QPointer<Rpc> rpc;
+    QPointer<Peer> loopback;
+    QByteArray linkKey;
     CoroutineGroup *operations;
     quint64 nextRequestId;
 
@@ -143,6 +147,52 @@ PeerPrivate::PeerPrivate(const QString &name, const QSharedPointer<DataChannel>
     , broken(false)
 {
     operations->spawn([this] { handlePacket(); });
+    const QByteArray &linkKey = channel->property("inproc_link").toByteArray();
+    if (!linkKey.isEmpty()) {
+        link(linkKey);
+    }
+}
+
+struct LoopbackRegistry
+{
+    QMutex lock;
+    QMap<QByteArray, QPointer<Peer>> pending;
+};
+
+Q_GLOBAL_STATIC(LoopbackRegistry, loopbackRegistry)
+
+// the two ends of inproc socket pair are created in any order, the later one links both.
+void PeerPrivate::link(const QByteArray &linkKey)
+{
+    Q_Q(Peer);
+    QPointer<Peer> other;
+    {
+        QMutexLocker locker(&loopbackRegistry()->lock);
+        other = loopbackRegistry()->pending.take(linkKey);
+        if (other.isNull()) {
+            loopbackRegistry()->pending.insert(linkKey, q);
+            this->linkKey = linkKey;
+            return;
+        }
+    }
+    // the server side peer may be dispatched to other shard.
+    if (other->thread() != q->thread()) {
+        return;
+    }
+    loopback = other;
+    other->d_func()->loopback = q;
+}
+
+PeerPrivate *PeerPrivate::linkedPeer() const
+{
+    if (broken || loopback.isNull() || rpc.isNull() || rpc->dd_ptr->forceSerialization) {
+        return nullptr;
+    }
+    PeerPrivate *other = loopback->d_func();
+    if (other->broken || other->rpc.isNull() || other->rpc->dd_ptr->forceSerialization) {
+        return nullptr;
+    }
+    return other;
 }
 
 PeerPrivate::~PeerPrivate()
@@ -159,6 +209,14 @@ void PeerPrivate::shutdown()
         return;
     }
     broken = true;
+    if (!linkKey.isEmpty()) {
+        // the other end never came, do not leave this peer in the registry.
+        QMutexLocker locker(&loopbackRegistry()->lock);
+        if (loopbackRegistry()->pending.value(linkKey).data() == q) {
+            loopbackRegistry()->pending.remove(linkKey);
+        }
+        linkKey.clear();
+    }
     QSharedPointer<Response> emptyResponse(new Response());
     for (QMap<QByteArray, QSharedPointer<Waiter>>::const_iterator itor = waiters.constBegin();
          itor != waiters.constEnd(); ++itor) {
@@ -279,11 +337,17 @@ QVariant PeerPrivate::call(const QString &methodName, const QVariantList &args,
         request.rawSocket = connectionId;
     }
 
-    QByteArray requestBytes = packRequest(rpc.data()->serialization(), request);
-    if (requestBytes.isEmpty()) {
-        throw RpcSerializationException(
-                QString::fromUtf8("can not serialize request while calling remote method: %1").arg(methodName));
+    // the sub channel is created by a packet in the channel, so the use-stream request must follow it.
+    PeerPrivate *other = streamFromClient.isNull() ? linkedPeer() : nullptr;
+    QByteArray requestBytes;
+    if (!other) {
+        requestBytes = packRequest(rpc.data()->serialization(), request);
+        if (requestBytes.isEmpty()) {
+            throw RpcSerializationException(
+                    QString::fromUtf8("can not serialize request while calling remote method: %1").arg(methodName));
+        }
     }
+    // shutdown() has cleared the waiters, a waiter inserted now is never woken.
     if (broken || rpc.isNull()) {
         throw RpcDisconnectedException(QString::fromUtf8("rpc is gone."));
     }
@@ -291,10 +355,15 @@ QVariant PeerPrivate::call(const QString &methodName, const QVariantList &args,
     QSharedPointer<Waiter> waiter(new Waiter());
     waiters.insert(request.id, waiter);
 
-    success = channel->sendPacket(requestBytes);
-    if (!success) {
-        shutdown();
-        throw RpcDisconnectedException(QString::fromUtf8("can not send packet."));
+    if (other) {
+        QSharedPointer<Request> linkedRequest(new Request(request));
+        other->operations->spawn([other, linkedRequest] { other->handleRequest(linkedRequest); });
+    } else {
+        success = channel->sendPacket(requestBytes);
+        if (!success) {
+            shutdown();
+            throw RpcDisconnectedException(QString::fromUtf8("can not send packet."));
+        }
     }
 
     if (broken || rpc.isNull()) {
@@ -546,15 +615,23 @@ void PeerPrivate::handleRequest(QSharedPointer<Request> request)
         response.result.clear();
     }
 
-    const QByteArray &responseBytes = packResponse(rpc.data()->serialization(), response);
-    if (responseBytes.isEmpty()) {
-        qCDebug(logger) << "can not serialize response.";
-        return;
-    }
+    PeerPrivate *other = response.channel == 0 ? linkedPeer() : nullptr;
+    if (other) {
+        QSharedPointer<Waiter> waiter = other->waiters.value(response.id);
+        if (!waiter.isNull()) {
+            waiter->send(QSharedPointer<Response>(new Response(response)));
+        }
+    } else {
+        const QByteArray &responseBytes = packResponse(rpc.data()->serialization(), response);
+        if (responseBytes.isEmpty()) {
+            qCDebug(logger) << "can not serialize response.";
+            return;
+        }
 
-    success = channel->sendPacket(responseBytes);
-    if (!success || broken || rpc.isNull()) {
-        return;
+        success = channel->sendPacket(responseBytes);
+        if (!success || broken || rpc.isNull()) {
+            return;
+        }
     }
 
     if (!response.exception.isNull()) {
@@ -805,6 +882,12 @@ bool Peer::isActive() const
     return !d->waiters.isEmpty();
 }
 
+int Peer::pendingCalls() const
+{
+    Q_D(const Peer);
+    return d->waiters.size();
+}
+
 QString Peer::name() const
 {
     Q_D(const Peer);
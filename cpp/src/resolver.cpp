@@ -0,0 +1,165 @@
+#include "../include/rpc_p.h"
+#include <QtCore/qdatetime.h>
+#include <QtCore/qloggingcategory.h>
+
+static Q_LOGGING_CATEGORY(logger, "lafrpc.resolver");
+
+using namespace qtng;
+
+BEGIN_LAFRPC_NAMESPACE
+
+Resolver::Resolver()
+    : ttl(1000 * 60)
+    , negativeTtl(1000 * 5)
+    , connectionAttemptDelay(250)
+    , operations(new CoroutineGroup())
+{
+}
+
+Resolver::~Resolver()
+{
+    delete operations;
+}
+
+QList<HostAddress> Resolver::resolve(const QString &hostName)
+{
+    HostAddress literal(hostName);
+    if (!literal.isNull()) {
+        return QList<HostAddress>() << literal;
+    }
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QMap<QString, Entry>::const_iterator itor = entries.constFind(hostName);
+    if (itor != entries.constEnd() && itor.value().expireAt > now) {
+        // refresh the hot entries in the last quarter of ttl, so the callers never wait for them.
+        if (!itor.value().addresses.isEmpty() && itor.value().expireAt - now < static_cast<qint64>(ttl / 4)) {
+            refreshLater(hostName);
+        }
+        return itor.value().addresses;
+    }
+    return lookup(hostName);
+}
+
+void Resolver::prefetch(const QString &hostName)
+{
+    if (hostName.isEmpty() || !HostAddress(hostName).isNull() || entries.contains(hostName)) {
+        return;
+    }
+    refreshLater(hostName);
+}
+
+void Resolver::refreshLater(const QString &hostName)
+{
+    if (operations->has(hostName)) {
+        return;
+    }
+    operations->spawnWithName(hostName, [this, hostName] { lookup(hostName); });
+}
+
+// the concurrent lookups of the same host share one query.
+QList<HostAddress> Resolver::lookup(const QString &hostName)
+{
+    QSharedPointer<ValueEvent<QList<HostAddress>>> waiter = pending.value(hostName);
+    if (!waiter.isNull()) {
+        return waiter->tryWait();
+    }
+    waiter.reset(new ValueEvent<QList<HostAddress>>());
+    pending.insert(hostName, waiter);
+    QList<HostAddress> addresses;
+    try {
+        addresses = Socket::resolve(hostName);
+    } catch (...) {
+        pending.remove(hostName);
+        waiter->send(addresses);
+        throw;
+    }
+    pending.remove(hostName);
+
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    Entry &entry = entries[hostName];
+    if (!addresses.isEmpty()) {
+        entry.addresses = addresses;
+        entry.expireAt = now + static_cast<qint64>(ttl);
+    } else if (entry.addresses.isEmpty() || entry.expireAt <= now) {
+        qCDebug(logger) << "can not resolve" << hostName;
+        entry.addresses.clear();
+        entry.expireAt = now + static_cast<qint64>(negativeTtl);
+    } else {
+        // a failed refreshing keeps the old addresses until they are expired.
+        addresses = entry.addresses;
+    }
+    waiter->send(addresses);
+    return addresses;
+}
+
+QSharedPointer<Socket> Resolver::connect(const QString &hostName, quint16 port)
+{
+    const QList<HostAddress> &addresses = resolve(hostName);
+    // interleave the address families, starting with ipv6.
+    QList<HostAddress> ipv6, ipv4, ordered;
+    for (const HostAddress &address : addresses) {
+        if (address.protocol() == HostAddress::IPv6Protocol) {
+            ipv6.append(address);
+        } else {
+            ipv4.append(address);
+        }
+    }
+    for (int i = 0; i < qMax(ipv6.size(), ipv4.size()); ++i) {
+        if (i < ipv6.size()) {
+            ordered.append(ipv6.at(i));
+        }
+        if (i < ipv4.size()) {
+            ordered.append(ipv4.at(i));
+        }
+    }
+    if (ordered.isEmpty()) {
+        return QSharedPointer<Socket>();
+    }
+    if (ordered.size() == 1) {
+        QSharedPointer<Socket> s(new Socket(ordered.first().protocol()));
+        return s->connect(ordered.first(), port) ? s : QSharedPointer<Socket>();
+    }
+
+    // start the next attempt after a short delay or at once if the previous one failed, the first connected wins.
+    CoroutineGroup attempts;
+    ValueEvent<QSharedPointer<Socket>> connected;
+    QList<QSharedPointer<Event>> started;
+    for (int i = 0; i < ordered.size(); ++i) {
+        QSharedPointer<Event> start(new Event());
+        started.append(start);
+        if (i == 0) {
+            start->set();
+        } else {
+            const quint32 delay = connectionAttemptDelay * static_cast<quint32>(i);
+            attempts.spawn([start, delay] {
+                Coroutine::msleep(delay);
+                start->set();
+            });
+        }
+    }
+    int failures = 0;
+    for (int i = 0; i < ordered.size(); ++i) {
+        const HostAddress address = ordered.at(i);
+        QSharedPointer<Event> start = started.at(i);
+        QSharedPointer<Event> next = i + 1 < started.size() ? started.at(i + 1) : QSharedPointer<Event>();
+        const int total = ordered.size();
+        attempts.spawn([&connected, &failures, address, start, next, total, port] {
+            start->tryWait();
+            QSharedPointer<Socket> s(new Socket(address.protocol()));
+            if (s->connect(address, port)) {
+                connected.send(s);
+                return;
+            }
+            if (!next.isNull()) {
+                next->set();
+            }
+            if (++failures == total) {
+                connected.send(QSharedPointer<Socket>());
+            }
+        });
+    }
+    QSharedPointer<Socket> s = connected.tryWait();
+    attempts.killall();
+    return s;
+}
+
+END_LAFRPC_NAMESPACE
@@ -4,7 +4,10 @@
 #include "../include/sendfile.h"
 #include "../include/serialization.h"
 #include "../include/transport.h"
+#include "../include/wrapped_socket_p.h"
 #include <QtCore/qloggingcategory.h>
+#include <QtCore/qrandom.h>
+#include <QtCore/qurl.h>
 
 static Q_LOGGING_CATEGORY(logger, "lafrpc.rpc");
 
@@ -18,14 +21,161 @@ HeaderCallback::~HeaderCallback() { }
 LoggingCallback::~LoggingCallback() { }
 KcpFilter::~KcpFilter() { }
 
+PeerDirectory::PeerDirectory() { }
+
+void PeerDirectory::insert(const QString &name, const QSharedPointer<Peer> &peer)
+{
+    const QString &address = peer->address();
+    {
+        Bucket &b = bucket(peer->id());
+        QWriteLocker locker(&b.lock);
+        b.byId.insert(peer->id(), Entry { peer, name, address });
+        QMutexLocker flatLocker(&flatLock);
+        all.append(peer);
+    }
+    {
+        Bucket &b = bucket(name);
+        QWriteLocker locker(&b.lock);
+        QList<QSharedPointer<Peer>> &peers = b.byName[name];
+        if (peers.isEmpty()) {
+            QMutexLocker flatLocker(&flatLock);
+            names.append(name);
+        }
+        peers.append(peer);
+    }
+    if (!address.isEmpty()) {
+        Bucket &b = bucket(address);
+        QWriteLocker locker(&b.lock);
+        b.byAddress[address].append(peer);
+    }
+}
+
+static bool removeFrom(QHash<QString, QList<QSharedPointer<Peer>>> &peers, const QString &key, Peer *peer)
+{
+    QHash<QString, QList<QSharedPointer<Peer>>>::iterator itor = peers.find(key);
+    if (itor == peers.end()) {
+        return false;
+    }
+    QList<QSharedPointer<Peer>> &list = itor.value();
+    for (int i = 0; i < list.size(); ++i) {
+        if (list.at(i).data() == peer) {
+            list.removeAt(i);
+            if (list.isEmpty()) {
+                peers.erase(itor);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PeerDirectory::remove(const QString &name, Peer *peer)
+{
+    Entry entry;
+    {
+        Bucket &b = bucket(peer->id());
+        QWriteLocker locker(&b.lock);
+        QHash<quint64, Entry>::iterator itor = b.byId.find(peer->id());
+        if (itor == b.byId.end() || itor.value().peer.data() != peer || itor.value().name != name) {
+            return false;
+        }
+        entry = itor.value();
+        b.byId.erase(itor);
+        QMutexLocker flatLocker(&flatLock);
+        all.removeOne(entry.peer);
+    }
+    {
+        Bucket &b = bucket(entry.name);
+        QWriteLocker locker(&b.lock);
+        if (removeFrom(b.byName, entry.name, peer) && !b.byName.contains(entry.name)) {
+            QMutexLocker flatLocker(&flatLock);
+            names.removeOne(entry.name);
+        }
+    }
+    if (!entry.address.isEmpty()) {
+        Bucket &b = bucket(entry.address);
+        QWriteLocker locker(&b.lock);
+        removeFrom(b.byAddress, entry.address, peer);
+    }
+    return true;
+}
+
+bool PeerDirectory::contains(const QString &name) const
+{
+    const Bucket &b = bucket(name);
+    QReadLocker locker(&b.lock);
+    return b.byName.contains(name);
+}
+
+QSharedPointer<Peer> PeerDirectory::value(const QString &name) const
+{
+    const Bucket &b = bucket(name);
+    QReadLocker locker(&b.lock);
+    const QList<QSharedPointer<Peer>> &peers = b.byName.value(name);
+    return peers.isEmpty() ? QSharedPointer<Peer>() : peers.last();
+}
+
+QList<QSharedPointer<Peer>> PeerDirectory::values(const QString &name) const
+{
+    const Bucket &b = bucket(name);
+    QReadLocker locker(&b.lock);
+    return b.byName.value(name);
+}
+
+QList<QSharedPointer<Peer>> PeerDirectory::values() const
+{
+    QMutexLocker locker(&flatLock);
+    return all;
+}
+
+QStringList PeerDirectory::keys() const
+{
+    QMutexLocker locker(&flatLock);
+    return names;
+}
+
+QSharedPointer<Peer> PeerDirectory::findByAddress(const QString &address) const
+{
+    const Bucket &b = bucket(address);
+    QReadLocker locker(&b.lock);
+    for (const QSharedPointer<Peer> &peer : b.byAddress.value(address)) {
+        if (peer->address() == address) {
+            return peer;
+        }
+    }
+    return QSharedPointer<Peer>();
+}
+
+QSharedPointer<Peer> PeerDirectory::findById(quint64 id) const
+{
+    const Bucket &b = bucket(id);
+    QReadLocker locker(&b.lock);
+    return b.byId.value(id).peer;
+}
+
 RpcPrivate::RpcPrivate(const QSharedPointer<Serialization> &serialization, Rpc *parent)
     : maxPacketSize(0)
     , payloadSizeHint(0)
     , keepaliveTimeout(1000 * 20)
     , kcpMode(qtng::KcpSocket::Internet)
     , serialization(serialization)
+    , peers(new PeerDirectory())
     , operations(new qtng::CoroutineGroup)
     , dnsCache(new qtng::SocketDnsCache())
+    , resolver(new Resolver())
+    , workerThreads(1)
+    , reusePort(false)
+    , handshakeThreads(0)
+    , forceSerialization(false)
+    , coalescingBytes(0)
+    , coalescingDelay(0)
+    , readBufferSize(0)
+    , connectionsPerPeer(1)
+    , rawSocketTimeout(1000 * 60)
+    , maxRawSockets(1024)
+    , rawSocketPoolSize(0)
+    , nextShard(0)
+    , shardParent(nullptr)
     , q_ptr(parent)
 {
     myPeerName = createUuidAsString();
@@ -40,6 +190,9 @@ RpcPrivate::RpcPrivate(const QSharedPointer<Serialization> &serialization, Rpc *
     transports.append(QSharedPointer<Transport>(new HttpTransport(parent)));
     transports.append(QSharedPointer<Transport>(new HttpsTransport(parent)));
     transports.append(QSharedPointer<Transport>(new HttpSslTransport(parent)));
+    transports.append(QSharedPointer<Transport>(new UnixTransport(parent)));
+    transports.append(QSharedPointer<Transport>(new ShmTransport(parent)));
+    transports.append(QSharedPointer<Transport>(new InprocTransport(parent)));
 
     registerClass<RpcRemoteException>();
     registerClass<RpcFile>();
@@ -140,13 +293,64 @@ inline QSharedPointer<Transport> RpcPrivate::findTransport(const QString &addres
     return QSharedPointer<Transport>();
 }
 
+QSharedPointer<Transport> RpcPrivate::findTransportByName(const QString &name) const
+{
+    for (QSharedPointer<Transport> transport : transports) {
+        if (transport->name() == name) {
+            return transport;
+        }
+    }
+    return QSharedPointer<Transport>();
+}
+
 QString makeWorkerName(const QString &address)
 {
     return QString::fromLatin1("server_") + QString::number(qHash(address));
 }
 
+// the raw sockets are accepted by servers, so the reaper runs while any server is started.
+void RpcPrivate::reapRawSockets()
+{
+    while (true) {
+        qtng::Coroutine::msleep(qMax<quint64>(1000, rawSocketTimeout / 2));
+        for (QSharedPointer<Transport> transport : transports) {
+            int count = transport->reapRawSockets(static_cast<qint64>(rawSocketTimeout));
+            if (count > 0) {
+                qCDebug(logger) << "closed" << count << "raw sockets not taken in time by" << transport->name();
+            }
+        }
+    }
+}
+
+// the pooled raw sockets are closed in time, or the server side would drop them anyway.
+void RpcPrivate::expireRawSocketPool()
+{
+    while (!rawSocketPool.isEmpty()) {
+        qtng::Coroutine::msleep(qMax<quint64>(1000, rawSocketTimeout / 2));
+        const QDateTime &expired = QDateTime::currentDateTime().addMSecs(-static_cast<qint64>(rawSocketTimeout));
+        QMap<QString, QList<RawSocket>>::iterator itor = rawSocketPool.begin();
+        while (itor != rawSocketPool.end()) {
+            QList<RawSocket> &pooled = itor.value();
+            for (int i = pooled.size() - 1; i >= 0; --i) {
+                if (pooled.at(i).timeStamp < expired) {
+                    pooled.takeAt(i).connection->close();
+                }
+            }
+            if (pooled.isEmpty()) {
+                itor = rawSocketPool.erase(itor);
+            } else {
+                ++itor;
+            }
+        }
+    }
+}
+
 QList<bool> RpcPrivate::startServers(const QStringList &addresses, bool blocking)
 {
+    startShards();
+    if (!operations->has(QString::fromLatin1("reap_raw_sockets"))) {
+        operations->spawnWithName(QString::fromLatin1("reap_raw_sockets"), [this] { reapRawSockets(); });
+    }
     QList<bool> result;
     QList<QSharedPointer<qtng::Coroutine>> coroutines;
     for (QString address : addresses) {
@@ -160,8 +364,13 @@ QList<bool> RpcPrivate::startServers(const QStringList &addresses, bool blocking
                 qCWarning(logger) << "rpc does not support transport for" << address;
                 result.append(false);
             } else {
-                QSharedPointer<qtng::Coroutine> coroutine = operations->spawnWithName(
-                        workerName, [transport, address] { transport->startServer(address); });
+                QSharedPointer<qtng::Coroutine> coroutine;
+                if (reusePort && !shards.isEmpty() && transport->canReusePort()) {
+                    coroutine = operations->spawnWithName(workerName, [this, address] { serveInShards(address); });
+                } else {
+                    coroutine = operations->spawnWithName(workerName,
+                                                          [transport, address] { transport->startServer(address); });
+                }
                 coroutines.append(coroutine);
                 serverAddressList.append(address);
                 result.append(true);
@@ -188,6 +397,18 @@ QList<bool> RpcPrivate::stopServers(const QStringList &addresses)
     }
     for (const QString &address : serverAddressList) {
         const QString &workerName = makeWorkerName(address);
+        QSharedPointer<qtng::Event> stop = shardServerStops.take(address);
+        if (!stop.isNull()) {
+            // let the shards stop their servers before returning.
+            QSharedPointer<qtng::Coroutine> coroutine = operations->get(workerName);
+            stop->set();
+            if (!coroutine.isNull()) {
+                coroutine->join();
+            }
+            result.append(true);
+            this->serverAddressList.removeAll(address);
+            continue;
+        }
         bool success = operations->kill(workerName);
         result.append(success);
         this->serverAddressList.removeAll(address);
@@ -198,10 +419,14 @@ QList<bool> RpcPrivate::stopServers(const QStringList &addresses)
 void RpcPrivate::shutdown()
 {
     stopServers(QStringList());
-    for (QSharedPointer<Peer> peer : this->peers.values()) {
-        peer->close();
+    stopShards();
+    // the peer directory may be shared with other shards, only close the peers living in this thread.
+    for (QSharedPointer<Peer> peer : this->peers->values()) {
+        if (peer->thread() == QThread::currentThread()) {
+            peers->remove(peer->name(), peer.data());
+            peer->close();
+        }
     }
-    peers.clear();
     operations->killall();
 }
 
@@ -220,11 +445,28 @@ bool RpcPrivate::waitServers()
     return true;
 }
 
+QSharedPointer<Peer> RpcPrivate::leastBusyPeer(const QString &peerName, const QString &peerAddress) const
+{
+    QSharedPointer<Peer> found;
+    for (const QSharedPointer<Peer> &peer : peers->values(peerName)) {
+        if (!peerAddress.isEmpty() && peer->address() != peerAddress) {
+            continue;
+        }
+        if (peer->isOk() && (found.isNull() || peer->pendingCalls() < found->pendingCalls())) {
+            found = peer;
+        }
+    }
+    return found;
+}
+
 QSharedPointer<Peer> RpcPrivate::connect(const QString &peerNameOrAddress)
 {
-    if (peers.contains(peerNameOrAddress)) {
-        QSharedPointer<Peer> peer = peers.value(peerNameOrAddress);
+    if (peers->contains(peerNameOrAddress)) {
+        QSharedPointer<Peer> peer = leastBusyPeer(peerNameOrAddress);
         if (!peer.isNull()) {
+            if (connectionsPerPeer > 1 && knownAddresses.contains(peerNameOrAddress)) {
+                fillPool(peerNameOrAddress, knownAddresses.value(peerNameOrAddress));
+            }
             return peer;
         }
     }
@@ -235,10 +477,14 @@ QSharedPointer<Peer> RpcPrivate::connect(const QString &peerNameOrAddress)
         peerAddress = knownAddresses.value(peerNameOrAddress);
     } else if (peerNameOrAddress.contains(QString::fromLatin1("//"))) {
         peerAddress = peerNameOrAddress;
-        for (QSharedPointer<Peer> peer : peers.values()) {
-            if (peer->address() == peerAddress) {
-                return peer;
+        QSharedPointer<Peer> peer = peers->findByAddress(peerAddress);
+        if (!peer.isNull()) {
+            if (connectionsPerPeer > 1) {
+                // the peers sharing this name may be connected to other addresses.
+                QSharedPointer<Peer> leastBusy = leastBusyPeer(peer->name(), peerAddress);
+                return leastBusy.isNull() ? peer : leastBusy;
             }
+            return peer;
         }
     } else {
 #ifdef DEUBG_RPC_PROTOCOL
@@ -260,31 +506,18 @@ QSharedPointer<Peer> RpcPrivate::connect(const QString &peerNameOrAddress)
     if (connectingEvents.contains(peerAddress)) {
         event = connectingEvents.value(peerAddress);
         event->tryWait();
-        for (QSharedPointer<Peer> peer : peers.values()) {
-            if (peer->address() == peerAddress) {
-                return peer;
-            }
-        }
-        // fail to connect.
-        return QSharedPointer<Peer>();
+        // return null if fail to connect.
+        return peers->findByAddress(peerAddress);
     } else {
         event.reset(new qtng::Event);
         connectingEvents.insert(peerAddress, event);
     }
     try {
-        QSharedPointer<qtng::DataChannel> channel = transport->connect(peerAddress);
-        QSharedPointer<Peer> peer;
-        if (channel.isNull()) {
-#ifdef DEUBG_RPC_PROTOCOL
-            qCDebug(logger) << "Rpc::connect() -> can not connect to" << peerAddress;
-#endif
-        } else {
-            peer = preparePeer(channel, peerName, peerAddress);
-        }
+        QSharedPointer<Peer> peer = connectOne(transport, peerName, peerAddress);
         event->set();
         connectingEvents.remove(peerAddress);
-        if (!peer.isNull()) {
-            knownAddresses[peer->name()] = peerAddress;
+        if (!peer.isNull() && connectionsPerPeer > 1) {
+            fillPool(peer->name(), peerAddress);
         }
         return peer;
     } catch (...) {
@@ -294,6 +527,119 @@ QSharedPointer<Peer> RpcPrivate::connect(const QString &peerNameOrAddress)
     }
 }
 
+QSharedPointer<Peer> RpcPrivate::connectOne(QSharedPointer<Transport> transport, const QString &peerName,
+                                            const QString &peerAddress)
+{
+    QSharedPointer<qtng::DataChannel> channel = transport->connect(peerAddress);
+    QSharedPointer<Peer> peer;
+    if (channel.isNull()) {
+#ifdef DEUBG_RPC_PROTOCOL
+        qCDebug(logger) << "Rpc::connect() -> can not connect to" << peerAddress;
+#endif
+    } else {
+        peer = preparePeer(channel, peerName, peerAddress);
+    }
+    if (!peer.isNull()) {
+        knownAddresses[peer->name()] = peerAddress;
+    }
+    return peer;
+}
+
+// make the other connections of pool in background, the caller uses the connected one at once.
+void RpcPrivate::fillPool(const QString &peerName, const QString &peerAddress)
+{
+    auto isFull = [this, peerName, peerAddress] {
+        int connected = 0;
+        for (const QSharedPointer<Peer> &peer : peers->values(peerName)) {
+            if (peer->isOk() && peer->address() == peerAddress) {
+                ++connected;
+            }
+        }
+        return connected >= connectionsPerPeer;
+    };
+    if (fillingPools.contains(peerName) || isFull()) {
+        return;
+    }
+    fillingPools.insert(peerName);
+    operations->spawn([this, peerName, peerAddress, isFull] {
+        Cleaner cleaner([this, peerName] { fillingPools.remove(peerName); });
+        Q_UNUSED(cleaner);
+        QSharedPointer<Transport> transport = findTransport(peerAddress);
+        while (!transport.isNull() && !isFull()) {
+            if (connectOne(transport, peerName, peerAddress).isNull()) {
+                break;
+            }
+        }
+    });
+}
+
+static QString makeSupervisorName(const QString &peerNameOrAddress)
+{
+    return QString::fromLatin1("supervise_") + peerNameOrAddress;
+}
+
+// keep one connection more than used, so the calls fail over to the spare one when the other is dropped.
+void RpcPrivate::supervise(const QString &peerNameOrAddress)
+{
+    Q_Q(Rpc);
+    const quint32 minimumDelay = 100;
+    const quint32 maximumDelay = 1000 * 30;
+    // one more than the pool size, so a spare connection is always warm.
+    const int wanted = qMax(2, connectionsPerPeer + 1);
+    quint32 delay = minimumDelay;
+    QSharedPointer<qtng::Event> changed(new qtng::Event());
+    // the ids are addresses of peers, so forget them before the peers are deleted.
+    QSharedPointer<QSet<quint64>> watched(new QSet<quint64>());
+    auto watch = [q, changed, watched](const QSharedPointer<Peer> &peer) {
+        const quint64 id = peer->id();
+        if (watched->contains(id)) {
+            return;
+        }
+        watched->insert(id);
+        QObject::connect(peer.data(), &Peer::disconnected, q, [changed, watched, id] {
+            watched->remove(id);
+            changed->set();
+        });
+    };
+    QString peerName;
+    while (true) {
+        QSharedPointer<Peer> peer;
+        if (peerName.isEmpty()) {
+            peer = connect(peerNameOrAddress);
+            if (!peer.isNull()) {
+                peerName = peer->name();
+            }
+        } else {
+            int live = 0;
+            for (const QSharedPointer<Peer> &p : peers->values(peerName)) {
+                if (!p->isOk()) {
+                    continue;
+                }
+                ++live;
+                watch(p);
+            }
+            if (live >= wanted) {
+                changed->clear();
+                changed->tryWait();
+                continue;
+            }
+            const QString &address = knownAddresses.value(peerName);
+            QSharedPointer<Transport> transport = findTransport(address);
+            if (!transport.isNull()) {
+                peer = connectOne(transport, peerName, address);
+            }
+        }
+        if (peer.isNull()) {
+            // the jitter keeps the supervisors of many rpc from reconnecting to a restarted peer at the same time.
+            qtng::Coroutine::msleep(delay / 2 + QRandomGenerator::global()->bounded(delay / 2 + 1));
+            delay = qMin(delay * 2, maximumDelay);
+            continue;
+        }
+        delay = minimumDelay;
+        watch(peer);
+    }
+}
+
 QSharedPointer<qtng::SocketLike> RpcPrivate::makeRawSocket(const QString &peerName, QByteArray &connectionId)
 {
     const QString &address = knownAddresses.value(peerName);
@@ -312,16 +658,99 @@ QSharedPointer<qtng::SocketLike> RpcPrivate::makeRawSocket(const QString &peerNa
         return QSharedPointer<qtng::SocketLike>();
     }
 
-    return transport->makeRawSocket(address, connectionId);
+    // the handshake of pooled socket is its health check, the server side is waiting for it.
+    const QDateTime &now = QDateTime::currentDateTime();
+    while (!rawSocketPool.value(peerName).isEmpty()) {
+        QList<RawSocket> &pooled = rawSocketPool[peerName];
+        RawSocket rawSocket = pooled.takeLast();
+        if (pooled.isEmpty()) {
+            rawSocketPool.remove(peerName);
+        }
+        if (rawSocket.timeStamp.msecsTo(now) < static_cast<qint64>(rawSocketTimeout)
+                && Transport::handshakeRawSocket(rawSocket.connection, connectionId)) {
+            return recyclable(peerName, rawSocket.connection);
+        }
+        rawSocket.connection->close();
+    }
+    return recyclable(peerName, transport->makeRawSocket(address, connectionId));
+}
+
+QSharedPointer<qtng::SocketLike> RpcPrivate::recyclable(const QString &peerName,
+                                                        QSharedPointer<qtng::SocketLike> rawSocket)
+{
+    Q_Q(Rpc);
+    if (rawSocket.isNull() || rawSocketPoolSize <= 0) {
+        return rawSocket;
+    }
+    QPointer<Rpc> self(q);
+    RecyclableSocket::Recycler recycler = [self, peerName](QSharedPointer<qtng::SocketLike> s) {
+        if (self.isNull() || self->thread() != QThread::currentThread()) {
+            return;
+        }
+        RpcPrivate *d = getPrivateHelper(self.data());
+        QList<RawSocket> &pooled = d->rawSocketPool[peerName];
+        if (pooled.size() < d->rawSocketPoolSize) {
+            pooled.append(RawSocket(s, QDateTime::currentDateTime()));
+            const QString &expirerName = QString::fromLatin1("expire_raw_socket_pool");
+            if (!d->operations->has(expirerName)) {
+                d->operations->spawnWithName(expirerName, [d] { d->expireRawSocketPool(); });
+            }
+        } else {
+            s->close();
+        }
+    };
+    return QSharedPointer<qtng::SocketLike>(new RecyclableSocket(rawSocket, recycler));
+}
+
+// the accepted raw socket waits for the next handshake from the pool of the other side.
+QSharedPointer<qtng::SocketLike> RpcPrivate::recyclable(QSharedPointer<Transport> transport,
+                                                        QSharedPointer<qtng::SocketLike> rawSocket)
+{
+    Q_Q(Rpc);
+    if (rawSocket.isNull()) {
+        return rawSocket;
+    }
+    QPointer<Rpc> self(q);
+    QWeakPointer<Transport> weakTransport = transport;
+    RecyclableSocket::Recycler recycler = [self, weakTransport](QSharedPointer<qtng::SocketLike> s) {
+        QSharedPointer<Transport> transport = weakTransport.toStrongRef();
+        if (self.isNull() || transport.isNull() || self->thread() != QThread::currentThread()) {
+            return;
+        }
+        getPrivateHelper(self.data())->operations->spawn([transport, s] { transport->recycleRawSocket(s); });
+    };
+    return QSharedPointer<qtng::SocketLike>(new RecyclableSocket(rawSocket, recycler));
 }
 
 QSharedPointer<qtng::SocketLike> RpcPrivate::takeRawSocket(const QString &peerName, const QByteArray &connectionId)
 {
+    Q_Q(Rpc);
     Q_UNUSED(peerName);
     for (QSharedPointer<Transport> transport : transports) {
         QSharedPointer<qtng::SocketLike> rawSocket = transport->takeRawSocket(connectionId);
         if (!rawSocket.isNull()) {
-            return rawSocket;
+            return recyclable(transport, rawSocket);
+        }
+    }
+    // the raw socket may be accepted by the server of parent rpc, or other shards. it is used in this thread, so it
+    // is recycled to the transport of this rpc with the same name, which serves its next handshake.
+    RpcPrivate *root = shardParent ? getPrivateHelper(shardParent) : this;
+    QList<Rpc *> others;
+    if (root != this) {
+        others.append(shardParent);
+    }
+    for (RpcShard *shard : root->shards) {
+        if (shard->child() != q) {
+            others.append(shard->child());
+        }
+    }
+    for (Rpc *other : others) {
+        for (QSharedPointer<Transport> transport : getPrivateHelper(other)->transports) {
+            QSharedPointer<qtng::SocketLike> rawSocket = transport->takeRawSocket(connectionId);
+            if (!rawSocket.isNull()) {
+                QSharedPointer<Transport> own = findTransportByName(transport->name());
+                return recyclable(own.isNull() ? transport : own, rawSocket);
+            }
         }
     }
     return QSharedPointer<qtng::SocketLike>();
@@ -329,7 +758,7 @@ QSharedPointer<qtng::SocketLike> RpcPrivate::takeRawSocket(const QString &peerNa
 
 bool RpcPrivate::isConnected(const QString &peerName) const
 {
-    return peers.contains(peerName) && !peers.value(peerName).isNull();
+    return peers->contains(peerName) && !peers->value(peerName).isNull();
 }
 
 bool RpcPrivate::isConnecting(const QString &peerAddress) const
@@ -425,8 +854,14 @@ QSharedPointer<Peer> RpcPrivate::preparePeer(const QSharedPointer<qtng::DataChan
         peer->setProperty("peer_certificate", certPEM);
         peer->setProperty("peer_certificate_hash", certHash);
     }
+    const QVariant &peerPid = channel->property("peer_pid");
+    if (peerPid.isValid()) {
+        peer->setProperty("peer_pid", peerPid);
+        peer->setProperty("peer_uid", channel->property("peer_uid"));
+        peer->setProperty("peer_gid", channel->property("peer_gid"));
+    }
 
-    peers.insert(itsPeerName, peer);
+    peers->insert(itsPeerName, peer);
     QPointer<Rpc> self(q);
     qtng::callInEventLoopAsync([peer, self] {
         if (self.isNull()) {
@@ -457,12 +892,140 @@ void RpcPrivate::deleteCurrentPeerAndHeader()
 
 void RpcPrivate::removePeer(const QString &name, Peer *peer)
 {
-    const QList<QSharedPointer<Peer>> &l = peers.values(name);
-    for (QSharedPointer<Peer> p : l) {
-        if (p.data() == peer) {
-            peers.remove(name, p);
-            return;
+    peers->remove(name, peer);
+}
+
+bool RpcPrivate::startShards()
+{
+    Q_Q(Rpc);
+    if (workerThreads <= 1 || !shards.isEmpty() || shardParent) {
+        return false;
+    }
+    for (int i = 0; i < workerThreads; ++i) {
+        QSharedPointer<Rpc> child(new Rpc(serialization));
+        RpcPrivate *childPrivate = getPrivateHelper(child.data());
+        childPrivate->copySettings(this);
+        childPrivate->peers = peers;
+        childPrivate->shardParent = q;
+        child->setServices(q->getServices());
+        QObject::connect(child.data(), &Rpc::newPeer, q, &Rpc::newPeer, Qt::DirectConnection);
+        RpcShard *shard = new RpcShard(child, i);
+        child->moveToThread(shard);
+        shards.append(shard);
+        shard->start();
+    }
+    return true;
+}
+
+void RpcPrivate::stopShards()
+{
+    for (RpcShard *shard : shards) {
+        shard->stop();
+    }
+    for (RpcShard *shard : shards) {
+        shard->wait();
+        delete shard;
+    }
+    shards.clear();
+}
+
+bool RpcPrivate::dispatchPeer(QSharedPointer<qtng::SocketLike> request, const QString &transportName,
+                              const QString &address)
+{
+    if (shards.isEmpty()) {
+        return false;
+    }
+    QSharedPointer<Transport> transport = findTransportByName(transportName);
+    if (transport.isNull() || !transport->canDispatch()) {
+        return false;
+    }
+    RpcShard *shard = shards.at(nextShard);
+    nextShard = (nextShard + 1) % shards.size();
+    return shard->post([request, transportName, address](Rpc *rpc) {
+        for (QSharedPointer<Transport> transport : getPrivateHelper(rpc)->transports) {
+            if (transport->name() == transportName) {
+                transport->acceptPeer(request, address);
+                return;
+            }
+        }
+    });
+}
+
+void RpcPrivate::serveInShards(const QString &address)
+{
+    for (RpcShard *shard : shards) {
+        shard->post([address](Rpc *rpc) { rpc->startServer(address, false); });
+    }
+    // the shards accept connections by themselves, wait until stopServers() sets the event.
+    QSharedPointer<qtng::Event> stop(new qtng::Event());
+    shardServerStops.insert(address, stop);
+    Cleaner cleaner([this, address, stop] {
+        if (shardServerStops.value(address) == stop) {
+            shardServerStops.remove(address);
+        }
+        for (RpcShard *shard : shards) {
+            shard->post([address](Rpc *rpc) { rpc->stopServer(address); });
         }
+    });
+    Q_UNUSED(cleaner);
+    stop->tryWait();
+}
+
+void RpcPrivate::setHandshakeThreads(int handshakeThreads)
+{
+    this->handshakeThreads = qMax(0, handshakeThreads);
+    if (this->handshakeThreads > 0) {
+        handshakePool.reset(new HandshakePool(this->handshakeThreads));
+    } else {
+        handshakePool.clear();
+    }
+}
+
+bool RpcPrivate::handshake(QSharedPointer<qtng::SslSocket> ssl, bool asServer)
+{
+    QSharedPointer<HandshakePool> pool = handshakePool;
+    if (handshakeThreads <= 0 || pool.isNull()) {
+        return ssl->handshake(asServer);
+    }
+    // the asymmetric crypto blocks the event loop, so do it in the worker threads.
+    return pool->handshake(ssl, asServer);
+}
+
+void RpcPrivate::copySettings(const RpcPrivate *other)
+{
+    myPeerName = other->myPeerName;
+    maxPacketSize = other->maxPacketSize;
+    payloadSizeHint = other->payloadSizeHint;
+    keepaliveTimeout = other->keepaliveTimeout;
+    kcpMode = other->kcpMode;
+    reusePort = other->reusePort;
+    // the shards share the workers of parent, so the bound is handshakeThreads in total.
+    handshakeThreads = other->handshakeThreads;
+    handshakePool = other->handshakePool;
+    forceSerialization = other->forceSerialization;
+    coalescingBytes = other->coalescingBytes;
+    coalescingDelay = other->coalescingDelay;
+    readBufferSize = other->readBufferSize;
+    connectionsPerPeer = other->connectionsPerPeer;
+    rawSocketTimeout = other->rawSocketTimeout;
+    maxRawSockets = other->maxRawSockets;
+    rawSocketPoolSize = other->rawSocketPoolSize;
+    resolver->ttl = other->resolver->ttl;
+    resolver->negativeTtl = other->resolver->negativeTtl;
+    headerCallback = other->headerCallback;
+    loggingCallback = other->loggingCallback;
+    kcpFilter = other->kcpFilter;
+    knownAddresses = other->knownAddresses;
+    // look the transports up by name, so adding or reordering transports does not break the copy.
+    QSharedPointer<SslTransport> sslTransport =
+            other->findTransportByName(QString::fromLatin1("SslTransport")).dynamicCast<SslTransport>();
+    if (!sslTransport.isNull()) {
+        setSslConfiguration(sslTransport->sslConfig);
+    }
+    QSharedPointer<HttpTransport> httpTransport =
+            other->findTransportByName(QString::fromLatin1("HttpTransport")).dynamicCast<HttpTransport>();
+    if (!httpTransport.isNull()) {
+        setHttpRootDir(httpTransport->rootDir);
     }
 }
 
@@ -639,30 +1202,48 @@ bool Rpc::isConnecting(const QString &peerAddress) const
 QSharedPointer<Peer> Rpc::get(const QString &peerName) const
 {
     Q_D(const Rpc);
-    for (QSharedPointer<Peer> peer : d->peers.values(peerName)) {
-        if (peer->isOk()) {
-            return peer;
-        }
-    }
-    return QSharedPointer<Peer>();
+    return d->leastBusyPeer(peerName);
 }
 
 QList<QSharedPointer<Peer>> Rpc::getAll(const QString &peerName) const
 {
     Q_D(const Rpc);
-    return d->peers.values(peerName);
+    return d->peers->values(peerName);
 }
 
 QStringList Rpc::getAllPeerNames() const
 {
     Q_D(const Rpc);
-    return d->peers.keys();
+    return d->peers->keys();
 }
 
 QList<QSharedPointer<Peer>> Rpc::getAllPeers() const
 {
     Q_D(const Rpc);
-    return d->peers.values();
+    return d->peers->values();
+}
+
+bool Rpc::supervise(const QString &peerNameOrAddress)
+{
+    Q_D(Rpc);
+    const QString &name = makeSupervisorName(peerNameOrAddress);
+    if (d->operations->has(name)) {
+        return false;
+    }
+    d->operations->spawnWithName(name, [d, peerNameOrAddress] { d->supervise(peerNameOrAddress); });
+    return true;
+}
+
+void Rpc::unsupervise(const QString &peerNameOrAddress)
+{
+    Q_D(Rpc);
+    d->operations->kill(makeSupervisorName(peerNameOrAddress));
+}
+
+QSharedPointer<Peer> Rpc::getById(quint64 peerId) const
+{
+    Q_D(const Rpc);
+    return d->peers->findById(peerId);
 }
 
 QString Rpc::address(const QString &peerName) const
@@ -675,6 +1256,12 @@ void Rpc::setAddress(const QString &peerName, const QString &peerAddress)
 {
     Q_D(Rpc);
     d->knownAddresses.insert(peerName, peerAddress);
+    // warm up the dns cache before the first connect(). the other schemes do not name a host.
+    const QUrl url(peerAddress);
+    static const QStringList resolvedSchemes = QString::fromLatin1("tcp ssl kcp kcp+ssl ssl+kcp http https").split(' ');
+    if (resolvedSchemes.contains(url.scheme(), Qt::CaseInsensitive) && !url.host().isEmpty()) {
+        d->resolver->prefetch(url.host());
+    }
 }
 
 QPointer<Peer> Rpc::getCurrentPeer()
@@ -799,6 +1386,96 @@ RpcBuilder &RpcBuilder::keepaliveTimeout(float keepaliveTimeout)
     return *this;
 }
 
+RpcBuilder &RpcBuilder::workerThreads(int workerThreads)
+{
+    if (!rpc.isNull()) {
+        rpc->d_func()->workerThreads = qMax(1, workerThreads);
+    }
+    return *this;
+}
+
+RpcBuilder &RpcBuilder::reusePort(bool reusePort)
+{
+    if (!rpc.isNull()) {
+        rpc->d_func()->reusePort = reusePort;
+    }
+    return *this;
+}
+
+RpcBuilder &RpcBuilder::handshakeThreads(int handshakeThreads)
+{
+    if (!rpc.isNull()) {
+        rpc->d_func()->setHandshakeThreads(handshakeThreads);
+    }
+    return *this;
+}
+
+RpcBuilder &RpcBuilder::forceSerialization(bool forceSerialization)
+{
+    if (!rpc.isNull()) {
+        rpc->d_func()->forceSerialization = forceSerialization;
+    }
+    return *this;
+}
+
+RpcBuilder &RpcBuilder::writeCoalescing(quint32 maxBytes, float maxDelay)
+{
+    if (!rpc.isNull()) {
+        rpc->d_func()->coalescingBytes = maxBytes;
+        rpc->d_func()->coalescingDelay = static_cast<quint32>(qMax(0.0f, maxDelay) * 1000.0f);
+    }
+    return *this;
+}
+
+RpcBuilder &RpcBuilder::readCoalescing(quint32 bufferSize)
+{
+    if (!rpc.isNull()) {
+        rpc->d_func()->readBufferSize = bufferSize;
+    }
+    return *this;
+}
+
+RpcBuilder &RpcBuilder::connectionsPerPeer(int connectionsPerPeer)
+{
+    if (!rpc.isNull()) {
+        rpc->d_func()->connectionsPerPeer = qMax(1, connectionsPerPeer);
+    }
+    return *this;
+}
+
+RpcBuilder &RpcBuilder::rawSocketTimeout(float rawSocketTimeout)
+{
+    if (!rpc.isNull()) {
+        rpc->d_func()->rawSocketTimeout = static_cast<quint64>(qMax(1.0f, rawSocketTimeout) * 1000.0f);
+    }
+    return *this;
+}
+
+RpcBuilder &RpcBuilder::maxRawSockets(int maxRawSockets)
+{
+    if (!rpc.isNull()) {
+        rpc->d_func()->maxRawSockets = qMax(0, maxRawSockets);
+    }
+    return *this;
+}
+
+RpcBuilder &RpcBuilder::rawSocketPoolSize(int rawSocketPoolSize)
+{
+    if (!rpc.isNull()) {
+        rpc->d_func()->rawSocketPoolSize = qMax(0, rawSocketPoolSize);
+    }
+    return *this;
+}
+
+RpcBuilder &RpcBuilder::dnsTtl(float ttl, float negativeTtl)
+{
+    if (!rpc.isNull()) {
+        rpc->d_func()->resolver->ttl = static_cast<quint64>(qMax(0.0f, ttl) * 1000.0f);
+        rpc->d_func()->resolver->negativeTtl = static_cast<quint64>(qMax(0.0f, negativeTtl) * 1000.0f);
+    }
+    return *this;
+}
+
 RpcBuilder &RpcBuilder::myPeerName(const QString &myPeerName)
 {
     if (!rpc.isNull()) {
@@ -1,8 +1,14 @@
 #include "../include/senddir.h"
+#include "../include/chunkstore_p.h"
+#include "../include/zerocopy_p.h"
 #include <QtCore/qdebug.h>
+#include <QtCore/qendian.h>
 
 using namespace qtng;
 
+// the index of the sub channel carrying the packed small files.
+const static quint32 PACKED_INDEX = 0xffffffff;
+
 BEGIN_LAFRPC_NAMESPACE
 
 RpcDirFileEntry::RpcDirFileEntry()
@@ -54,6 +60,13 @@ QSharedPointer<FileLike> NativeRpcDirFileProvider::getFile(const QString &filePa
         qDebug() << "can not open file:" << fullFilePath;
         return QSharedPointer<FileLike>();
     }
+    // the senders take slices of the mapping instead of reading.
+    if (memoryMapped && mode == QIODevice::ReadOnly) {
+        QSharedPointer<FileLike> mapped = MappedFile::map(file);
+        if (!mapped.isNull()) {
+            return mapped;
+        }
+    }
     return FileLike::rawFile(file);
 }
 
@@ -92,6 +105,26 @@ public:
 public:
     bool writeTo(QSharedPointer<RpcDirFileProvider> provider, RpcDir::ProgressCallback progressCallback);
     bool readFrom(QSharedPointer<RpcDirFileProvider> provider, RpcDir::ProgressCallback progressCallback);
+    bool writeConcurrently(QSharedPointer<RpcDirFileProvider> provider, RpcDir::ProgressCallback progressCallback,
+                           int files, const QList<int> &packed, quint64 *totalWritten);
+    bool readConcurrently(QSharedPointer<RpcDirFileProvider> provider, RpcDir::ProgressCallback progressCallback,
+                          const QList<int> &largeFiles, const QList<int> &packed, quint64 *totalRead);
+    bool writeFile(QSharedPointer<RpcDirFileProvider> provider, const RpcDirFileEntry &entry,
+                   QSharedPointer<DataChannel> channel, RpcDir::ProgressCallback progressCallback,
+                   quint64 *totalWritten, bool *aborted);
+    bool readFile(QSharedPointer<RpcDirFileProvider> provider, const RpcDirFileEntry &entry,
+                  QSharedPointer<DataChannel> channel, RpcDir::ProgressCallback progressCallback, quint64 *totalRead,
+                  bool *aborted);
+    bool writePacked(QSharedPointer<RpcDirFileProvider> provider, const QList<int> &packed,
+                     QSharedPointer<DataChannel> channel, RpcDir::ProgressCallback progressCallback,
+                     quint64 *totalWritten, bool *aborted);
+    bool readPacked(QSharedPointer<RpcDirFileProvider> provider, const QList<int> &packed,
+                    QSharedPointer<DataChannel> channel, RpcDir::ProgressCallback progressCallback, quint64 *totalRead,
+                    bool *aborted);
+    bool isPacked(const RpcDirFileEntry &entry) const
+    {
+        return !entry.isdir && entry.size > 0 && entry.size < packThreshold;
+    }
 public:
     QString name;
     QString dirPath;
@@ -100,6 +133,11 @@ public:
     QDateTime lastModified;
     QDateTime lastAccess;
     QList<RpcDirFileEntry> entries;
+    bool chunked;
+    QSharedPointer<RpcChunkStore> chunkStore;
+    int concurrency;
+    quint64 packThreshold;
+    bool memoryMapped;
 private:
     RpcDir * const q_ptr;
     Q_DECLARE_PUBLIC(RpcDir)
@@ -107,6 +145,10 @@ private:
 
 RpcDirPrivate::RpcDirPrivate(RpcDir *q)
     : size(0)
+    , chunked(false)
+    , concurrency(1)
+    , packThreshold(0)
+    , memoryMapped(false)
     , q_ptr(q)
 {
 }
@@ -115,7 +157,10 @@ bool RpcDirPrivate::writeTo(QSharedPointer<RpcDirFileProvider> provider, RpcDir:
 {
     Q_Q(RpcDir);
     quint64 totalWritten = 0;
-    for (const RpcDirFileEntry &entry : entries) {
+    int files = 0;
+    QList<int> packed;
+    for (int i = 0; i < entries.size(); ++i) {
+        const RpcDirFileEntry &entry = entries.at(i);
         if (entry.isdir) {
             if (!provider->createDirectory(entry.path)) {
                 if (progressCallback)
@@ -135,58 +180,180 @@ bool RpcDirPrivate::writeTo(QSharedPointer<RpcDirFileProvider> provider, RpcDir:
                 if (progressCallback)
                     progressCallback(CallbackInfo(entry.path, 0, 0, 0, totalWritten, this->size));
             }
+        } else if (isPacked(entry)) {
+            // the small files are received in one stream after all directories are made.
+            packed.append(i);
+        } else if (concurrency > 1) {
+            // the files are received at the same time after all directories are made.
+            ++files;
         } else {
-            QSharedPointer<FileLike> file = provider->getFile(entry.path, QIODevice::WriteOnly);
-            if (file.isNull()) {
-                if (progressCallback)
-                    progressCallback(CallbackInfo(entry.path, -1, 0, entry.size, totalWritten, this->size));
-                return false;
-            }
             QSharedPointer<DataChannel> channel = q->channel->makeChannel();
             if (channel.isNull()) {
                 if (progressCallback)
                     progressCallback(CallbackInfo(entry.path, -1, 0, entry.size, totalWritten, this->size));
                 return false;
             }
+            bool aborted = false;
+            if (!writeFile(provider, entry, channel, progressCallback, &totalWritten, &aborted)) {
+                return false;
+            }
+            if (aborted) {
+                return true;
+            }
+        }
+    }
+    if (files > 0) {
+        return writeConcurrently(provider, progressCallback, files, packed, &totalWritten);
+    }
+    if (!packed.isEmpty()) {
+        QSharedPointer<DataChannel> channel = q->channel->makeChannel();
+        if (channel.isNull()) {
+            if (progressCallback)
+                progressCallback(CallbackInfo("", -1, 0, 0, totalWritten, this->size));
+            return false;
+        }
+        bool aborted = false;
+        return writePacked(provider, packed, channel, progressCallback, &totalWritten, &aborted);
+    }
+    return true;
+}
 
-            quint64 fileWritten = 0;
-            while (fileWritten < entry.size) {
-                const QByteArray &buf = channel->recvPacket();
-                if (buf.isEmpty()) {
-                    if (progressCallback)
-                        progressCallback(
-                                CallbackInfo(entry.path, -1, fileWritten, entry.size, totalWritten, this->size));
-                    return false;
+// every file comes in its own sub channel, which starts with the 4-byte index of the file entry. the packed small
+// files share one more sub channel.
+bool RpcDirPrivate::writeConcurrently(QSharedPointer<RpcDirFileProvider> provider,
+                                      RpcDir::ProgressCallback progressCallback, int files, const QList<int> &packed,
+                                      quint64 *totalWritten)
+{
+    Q_Q(RpcDir);
+    if (!packed.isEmpty()) {
+        ++files;
+    }
+    int claimed = 0;
+    int finished = 0;
+    bool failed = false;
+    bool aborted = false;
+    Event done;
+    CoroutineGroup operations;
+    for (int i = 0; i < qMin(concurrency, files); ++i) {
+        operations.spawn([this, q, provider, progressCallback, files, &packed, totalWritten, &claimed, &finished,
+                          &failed, &aborted, &done] {
+            auto fail = [&](const QString &path) {
+                if (progressCallback)
+                    progressCallback(CallbackInfo(path, -1, 0, 0, *totalWritten, this->size));
+                failed = true;
+                done.set();
+            };
+            // every channel carries one file, so the sender takes exactly as many channels as made here.
+            while (claimed < files) {
+                ++claimed;
+                QSharedPointer<DataChannel> channel = q->channel->makeChannel();
+                if (channel.isNull()) {
+                    return fail(QString());
                 }
-                if (file->write(buf.data(), buf.size()) != buf.size()) {
-                    if (progressCallback)
-                        progressCallback(
-                                CallbackInfo(entry.path, -1, fileWritten, entry.size, totalWritten, this->size));
-                    return false;
+                const QByteArray &header = channel->recvPacket();
+                if (header.size() != 4) {
+                    qDebug() << "rpc dir receiving error: invalid file index.";
+                    return fail(QString());
                 }
-                fileWritten += static_cast<quint64>(buf.size());
-                totalWritten += static_cast<quint64>(buf.size());
-                if (progressCallback) {
-                    bool keepGoing = progressCallback(
-                            CallbackInfo(entry.path, buf.size(), fileWritten, entry.size, totalWritten, this->size));
-                    if (!keepGoing) {
-                        return true;
-                    }
+                const quint32 index = qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(header.constData()));
+                bool success;
+                if (index == PACKED_INDEX && !packed.isEmpty()) {
+                    success = writePacked(provider, packed, channel, progressCallback, totalWritten, &aborted);
+                } else if (index >= static_cast<quint32>(entries.size()) || entries.at(static_cast<int>(index)).isdir
+                           || entries.at(static_cast<int>(index)).size == 0
+                           || isPacked(entries.at(static_cast<int>(index)))) {
+                    qDebug() << "rpc dir receiving error: invalid file index.";
+                    return fail(QString());
+                } else {
+                    const RpcDirFileEntry &entry = entries.at(static_cast<int>(index));
+                    success = writeFile(provider, entry, channel, progressCallback, totalWritten, &aborted);
                 }
-            }
-            if (fileWritten > entry.size) {
-                if (progressCallback)
-                    progressCallback(CallbackInfo(entry.path, -1, fileWritten, entry.size, totalWritten, this->size));
-                return false;
-            } else {
-                bool ok = provider->updateTimes(entry.path, entry.created, entry.lastModified, entry.lastAccess);
-                if (!ok) {
-                    if (progressCallback)
-                        progressCallback(
-                                CallbackInfo(entry.path, -1, fileWritten, entry.size, totalWritten, this->size));
-                    return false;
+                if (!success) {
+                    failed = true;
+                    done.set();
+                    return;
+                }
+                ++finished;
+                if (aborted || finished == files) {
+                    done.set();
+                    return;
                 }
             }
+        });
+    }
+    done.tryWait();
+    operations.killall();
+    return !failed;
+}
+
+bool RpcDirPrivate::writeFile(QSharedPointer<RpcDirFileProvider> provider, const RpcDirFileEntry &entry,
+                              QSharedPointer<DataChannel> channel, RpcDir::ProgressCallback progressCallback,
+                              quint64 *totalWritten, bool *aborted)
+{
+    QSharedPointer<FileLike> file = provider->getFile(entry.path, QIODevice::WriteOnly);
+    if (file.isNull()) {
+        if (progressCallback)
+            progressCallback(CallbackInfo(entry.path, -1, 0, entry.size, *totalWritten, this->size));
+        return false;
+    }
+
+    quint64 fileWritten = 0;
+    if (chunked) {
+        QByteArray digest;
+        bool success = ChunkedTransfer::recv(
+                file, entry.size, chunkStore, [channel](const QByteArray &frame) { return channel->sendPacket(frame); },
+                [channel] { return channel->recvPacket(); },
+                [&](qint64 bs) {
+                    fileWritten += static_cast<quint64>(bs);
+                    *totalWritten += static_cast<quint64>(bs);
+                    *aborted = progressCallback
+                            && !progressCallback(CallbackInfo(entry.path, static_cast<qint32>(bs), fileWritten,
+                                                              entry.size, *totalWritten, this->size));
+                    return !*aborted;
+                },
+                &digest);
+        if (*aborted) {
+            return true;
+        }
+        if (!success) {
+            if (progressCallback)
+                progressCallback(CallbackInfo(entry.path, -1, fileWritten, entry.size, *totalWritten, this->size));
+            return false;
+        }
+    }
+    while (!chunked && fileWritten < entry.size) {
+        const QByteArray &buf = channel->recvPacket();
+        if (buf.isEmpty()) {
+            if (progressCallback)
+                progressCallback(CallbackInfo(entry.path, -1, fileWritten, entry.size, *totalWritten, this->size));
+            return false;
+        }
+        if (file->write(buf.data(), buf.size()) != buf.size()) {
+            if (progressCallback)
+                progressCallback(CallbackInfo(entry.path, -1, fileWritten, entry.size, *totalWritten, this->size));
+            return false;
+        }
+        fileWritten += static_cast<quint64>(buf.size());
+        *totalWritten += static_cast<quint64>(buf.size());
+        if (progressCallback) {
+            bool keepGoing = progressCallback(
+                    CallbackInfo(entry.path, buf.size(), fileWritten, entry.size, *totalWritten, this->size));
+            if (!keepGoing) {
+                *aborted = true;
+                return true;
+            }
+        }
+    }
+    if (fileWritten > entry.size) {
+        if (progressCallback)
+            progressCallback(CallbackInfo(entry.path, -1, fileWritten, entry.size, *totalWritten, this->size));
+        return false;
+    } else {
+        bool ok = provider->updateTimes(entry.path, entry.created, entry.lastModified, entry.lastAccess);
+        if (!ok) {
+            if (progressCallback)
+                progressCallback(CallbackInfo(entry.path, -1, fileWritten, entry.size, *totalWritten, this->size));
+            return false;
         }
     }
     return true;
@@ -199,52 +366,286 @@ bool RpcDirPrivate::readFrom(QSharedPointer<RpcDirFileProvider> provider, RpcDir
         return false;
     }
     quint64 totalRead = 0;
-    QByteArray buf(1024 * 64, Qt::Uninitialized);
-    for (const RpcDirFileEntry &entry : entries) {
+    QList<int> files;
+    QList<int> packed;
+    for (int i = 0; i < entries.size(); ++i) {
+        const RpcDirFileEntry &entry = entries.at(i);
         if (entry.isdir || entry.size == 0) {
             if (progressCallback)
                 progressCallback(CallbackInfo(entry.path, 0, 0, 0, totalRead, this->size));
+        } else if (isPacked(entry)) {
+            packed.append(i);
+        } else if (concurrency > 1) {
+            files.append(i);
         } else {
-            QSharedPointer<FileLike> file = provider->getFile(entry.path, QIODevice::ReadOnly);
-            if (file.isNull()) {
-                if (progressCallback)
-                    progressCallback(CallbackInfo(entry.path, -1, 0, entry.size, totalRead, this->size));
-                return false;
-            }
             QSharedPointer<DataChannel> channel = q->channel->takeChannel();
             if (channel.isNull()) {
                 if (progressCallback)
                     progressCallback(CallbackInfo("", -1, 0, 0, totalRead, this->size));
                 return false;
             }
-            quint64 fileRead = 0;
-            qint32 blockSize = static_cast<qint32>(channel->payloadSizeHint());
-            while (fileRead < entry.size) {
-                qint32 bs = file->read(buf.data(), blockSize);
-                if (bs <= 0) {
+            bool aborted = false;
+            if (!readFile(provider, entry, channel, progressCallback, &totalRead, &aborted)) {
+                return false;
+            }
+            if (aborted) {
+                return true;
+            }
+        }
+    }
+    if (!files.isEmpty()) {
+        return readConcurrently(provider, progressCallback, files, packed, &totalRead);
+    }
+    if (!packed.isEmpty()) {
+        QSharedPointer<DataChannel> channel = q->channel->takeChannel();
+        if (channel.isNull()) {
+            if (progressCallback)
+                progressCallback(CallbackInfo("", -1, 0, 0, totalRead, this->size));
+            return false;
+        }
+        bool aborted = false;
+        return readPacked(provider, packed, channel, progressCallback, &totalRead, &aborted);
+    }
+    return true;
+}
+
+bool RpcDirPrivate::readConcurrently(QSharedPointer<RpcDirFileProvider> provider,
+                                     RpcDir::ProgressCallback progressCallback, const QList<int> &largeFiles,
+                                     const QList<int> &packed, quint64 *totalRead)
+{
+    Q_Q(RpcDir);
+    // the packed stream takes the longest, so it starts first.
+    QList<int> files = largeFiles;
+    if (!packed.isEmpty()) {
+        files.prepend(-1);
+    }
+    int next = 0;
+    int finished = 0;
+    bool failed = false;
+    bool aborted = false;
+    Event done;
+    CoroutineGroup operations;
+    for (int i = 0; i < qMin(concurrency, files.size()); ++i) {
+        operations.spawn([this, q, provider, progressCallback, &files, &packed, totalRead, &next, &finished, &failed,
+                          &aborted, &done] {
+            while (next < files.size()) {
+                const int index = files.at(next++);
+                QSharedPointer<DataChannel> channel = q->channel->takeChannel();
+                char header[4];
+                qToBigEndian<quint32>(index < 0 ? PACKED_INDEX : static_cast<quint32>(index),
+                                      reinterpret_cast<uchar *>(header));
+                if (channel.isNull() || !channel->sendPacket(QByteArray(header, 4))) {
                     if (progressCallback)
-                        progressCallback(CallbackInfo(entry.path, -1, fileRead, entry.size, totalRead, this->size));
-                    return false;
+                        progressCallback(CallbackInfo("", -1, 0, 0, *totalRead, this->size));
+                    failed = true;
+                    done.set();
+                    return;
+                }
+                const bool success = index < 0
+                        ? readPacked(provider, packed, channel, progressCallback, totalRead, &aborted)
+                        : readFile(provider, entries.at(index), channel, progressCallback, totalRead, &aborted);
+                if (!success) {
+                    failed = true;
+                    done.set();
+                    return;
                 }
-                if (!channel->sendPacket(QByteArray(buf.data(), bs))) {
+                ++finished;
+                if (aborted || finished == files.size()) {
+                    done.set();
+                    return;
+                }
+            }
+        });
+    }
+    done.tryWait();
+    operations.killall();
+    return !failed;
+}
+
+bool RpcDirPrivate::readFile(QSharedPointer<RpcDirFileProvider> provider, const RpcDirFileEntry &entry,
+                             QSharedPointer<DataChannel> channel, RpcDir::ProgressCallback progressCallback,
+                             quint64 *totalRead, bool *aborted)
+{
+    QSharedPointer<FileLike> file = provider->getFile(entry.path, QIODevice::ReadOnly);
+    if (file.isNull()) {
+        if (progressCallback)
+            progressCallback(CallbackInfo(entry.path, -1, 0, entry.size, *totalRead, this->size));
+        return false;
+    }
+    quint64 fileRead = 0;
+    if (chunked) {
+        QByteArray digest;
+        bool success = ChunkedTransfer::send(
+                file, entry.size, [channel](const QByteArray &frame) { return channel->sendPacket(frame); },
+                [channel] { return channel->recvPacket(); },
+                [&](qint64 bs) {
+                    fileRead += static_cast<quint64>(bs);
+                    *totalRead += static_cast<quint64>(bs);
+                    *aborted = progressCallback
+                            && !progressCallback(CallbackInfo(entry.path, static_cast<qint32>(bs), fileRead,
+                                                              entry.size, *totalRead, this->size));
+                    return !*aborted;
+                },
+                &digest);
+        if (*aborted) {
+            return true;
+        }
+        if (!success) {
+            if (progressCallback)
+                progressCallback(CallbackInfo(entry.path, -1, fileRead, entry.size, *totalRead, this->size));
+            return false;
+        }
+    }
+    qint32 blockSize = static_cast<qint32>(channel->payloadSizeHint());
+    while (!chunked && fileRead < entry.size) {
+        const quint64 left = entry.size - fileRead;
+        const QByteArray &buf = ZeroCopy::readPacket(
+                file.data(), static_cast<qint32>(qMin<quint64>(static_cast<quint64>(blockSize), left)));
+        const qint32 bs = buf.size();
+        if (bs <= 0) {
+            if (progressCallback)
+                progressCallback(CallbackInfo(entry.path, -1, fileRead, entry.size, *totalRead, this->size));
+            return false;
+        }
+        if (!channel->sendPacket(buf)) {
+            if (progressCallback)
+                progressCallback(CallbackInfo(entry.path, -1, fileRead, entry.size, *totalRead, this->size));
+            return false;
+        }
+        fileRead += static_cast<quint64>(bs);
+        *totalRead += static_cast<quint64>(bs);
+        if (progressCallback) {
+            bool keepGoing =
+                    progressCallback(CallbackInfo(entry.path, bs, fileRead, entry.size, *totalRead, this->size));
+            if (!keepGoing) {
+                *aborted = true;
+                return true;
+            }
+        }
+    }
+    channel->recvPacket();  // wait for remote closing the channel.
+    return true;
+}
+
+// the content of small files are sent back to back, the boundaries come from the sizes of entries.
+bool RpcDirPrivate::writePacked(QSharedPointer<RpcDirFileProvider> provider, const QList<int> &packed,
+                                QSharedPointer<DataChannel> channel, RpcDir::ProgressCallback progressCallback,
+                                quint64 *totalWritten, bool *aborted)
+{
+    int current = 0;
+    QSharedPointer<FileLike> file;
+    quint64 fileWritten = 0;
+    while (current < packed.size()) {
+        const QByteArray &buf = channel->recvPacket();
+        const RpcDirFileEntry &first = entries.at(packed.at(current));
+        if (buf.isEmpty()) {
+            if (progressCallback)
+                progressCallback(CallbackInfo(first.path, -1, fileWritten, first.size, *totalWritten, this->size));
+            return false;
+        }
+        int pos = 0;
+        while (pos < buf.size()) {
+            if (current >= packed.size()) {
+                qDebug() << "rpc dir receiving error: too many packed bytes.";
+                if (progressCallback)
+                    progressCallback(CallbackInfo("", -1, 0, 0, *totalWritten, this->size));
+                return false;
+            }
+            const RpcDirFileEntry &entry = entries.at(packed.at(current));
+            if (file.isNull()) {
+                file = provider->getFile(entry.path, QIODevice::WriteOnly);
+                if (file.isNull()) {
                     if (progressCallback)
-                        progressCallback(CallbackInfo(entry.path, -1, fileRead, entry.size, totalRead, this->size));
+                        progressCallback(CallbackInfo(entry.path, -1, 0, entry.size, *totalWritten, this->size));
                     return false;
                 }
-                fileRead += static_cast<quint64>(bs);
-                totalRead += static_cast<quint64>(bs);
-                if (progressCallback) {
-                    bool keepGoing =
-                            progressCallback(CallbackInfo(entry.path, bs, fileRead, entry.size, totalRead, this->size));
-                    if (!keepGoing) {
-                        return true;
-                    }
+            }
+            const qint32 bs = static_cast<qint32>(qMin<quint64>(entry.size - fileWritten, buf.size() - pos));
+            if (file->write(buf.constData() + pos, bs) != bs) {
+                if (progressCallback)
+                    progressCallback(CallbackInfo(entry.path, -1, fileWritten, entry.size, *totalWritten, this->size));
+                return false;
+            }
+            pos += bs;
+            fileWritten += static_cast<quint64>(bs);
+            *totalWritten += static_cast<quint64>(bs);
+            if (progressCallback) {
+                bool keepGoing = progressCallback(
+                        CallbackInfo(entry.path, bs, fileWritten, entry.size, *totalWritten, this->size));
+                if (!keepGoing) {
+                    *aborted = true;
+                    return true;
+                }
+            }
+            if (fileWritten == entry.size) {
+                // close the file before updating its times.
+                file.clear();
+                fileWritten = 0;
+                ++current;
+                if (!provider->updateTimes(entry.path, entry.created, entry.lastModified, entry.lastAccess)) {
+                    if (progressCallback)
+                        progressCallback(
+                                CallbackInfo(entry.path, -1, entry.size, entry.size, *totalWritten, this->size));
+                    return false;
                 }
             }
-            channel->recvPacket();  // wait for remote closing the channel.
         }
     }
+    return true;
+}
 
+bool RpcDirPrivate::readPacked(QSharedPointer<RpcDirFileProvider> provider, const QList<int> &packed,
+                               QSharedPointer<DataChannel> channel, RpcDir::ProgressCallback progressCallback,
+                               quint64 *totalRead, bool *aborted)
+{
+    const qint32 blockSize = static_cast<qint32>(channel->payloadSizeHint());
+    QByteArray packet;
+    packet.reserve(blockSize);
+    for (int index : packed) {
+        const RpcDirFileEntry &entry = entries.at(index);
+        QSharedPointer<FileLike> file = provider->getFile(entry.path, QIODevice::ReadOnly);
+        if (file.isNull()) {
+            if (progressCallback)
+                progressCallback(CallbackInfo(entry.path, -1, 0, entry.size, *totalRead, this->size));
+            return false;
+        }
+        quint64 fileRead = 0;
+        while (fileRead < entry.size) {
+            const int old = packet.size();
+            const qint32 want = static_cast<qint32>(qMin<quint64>(entry.size - fileRead, blockSize - old));
+            packet.resize(old + want);
+            const qint32 bs = file->read(packet.data() + old, want);
+            if (bs <= 0) {
+                if (progressCallback)
+                    progressCallback(CallbackInfo(entry.path, -1, fileRead, entry.size, *totalRead, this->size));
+                return false;
+            }
+            packet.resize(old + bs);
+            if (packet.size() >= blockSize) {
+                if (!channel->sendPacket(packet)) {
+                    if (progressCallback)
+                        progressCallback(CallbackInfo(entry.path, -1, fileRead, entry.size, *totalRead, this->size));
+                    return false;
+                }
+                // the channel holds the old buffer.
+                packet.clear();
+                packet.reserve(blockSize);
+            }
+            fileRead += static_cast<quint64>(bs);
+            *totalRead += static_cast<quint64>(bs);
+            if (progressCallback
+                && !progressCallback(CallbackInfo(entry.path, bs, fileRead, entry.size, *totalRead, this->size))) {
+                *aborted = true;
+                return true;
+            }
+        }
+    }
+    if (!packet.isEmpty() && !channel->sendPacket(packet)) {
+        if (progressCallback)
+            progressCallback(CallbackInfo("", -1, 0, 0, *totalRead, this->size));
+        return false;
+    }
+    channel->recvPacket();  // wait for remote closing the channel.
     return true;
 }
 
@@ -311,7 +712,7 @@ static void _populate(const QDir &dir, const QString &relativePath, PopulateResu
         result.entries.append(entry);
         result.totalSize += entry.size;
         if (fileInfo.isDir()) {
-            _populate(QDir(fileInfo.path()), entry.path, result);
+            _populate(QDir(fileInfo.filePath()), entry.path, result);
         }
     }
 }
@@ -331,7 +732,7 @@ bool RpcDir::populate()
     if (d->dirPath.isEmpty() || !QDir(d->dirPath).isReadable()) {
         return false;
     }
-    QString dirPath;
+    const QString dirPath = d->dirPath;
     PopulateResult result =
             qtng::callInThread<PopulateResult>([dirPath] { return LAFRPC_NAMESPACE::populate(dirPath); });
     d->entries = result.entries;
@@ -354,7 +755,9 @@ bool RpcDir::writeToPath(const QString &path, ProgressCallback progressCallback)
 bool RpcDir::readFromPath(const QString &path, ProgressCallback progressCallback)
 {
     Q_D(RpcDir);
-    return d->readFrom(QSharedPointer<NativeRpcDirFileProvider>::create(path), progressCallback);
+    QSharedPointer<NativeRpcDirFileProvider> provider = QSharedPointer<NativeRpcDirFileProvider>::create(path);
+    provider->memoryMapped = d->memoryMapped;
+    return d->readFrom(provider, progressCallback);
 }
 
 bool RpcDir::readFromPath(ProgressCallback progressCallback)
@@ -363,7 +766,7 @@ bool RpcDir::readFromPath(ProgressCallback progressCallback)
     if (d->dirPath.isEmpty()) {
         return false;
     }
-    return d->readFrom(QSharedPointer<NativeRpcDirFileProvider>::create(d->dirPath), progressCallback);
+    return readFromPath(d->dirPath, progressCallback);
 }
 
 bool RpcDir::writeTo(QSharedPointer<RpcDirFileProvider> provider, ProgressCallback progressCallback)
@@ -450,6 +853,66 @@ void RpcDir::setEntries(const QList<RpcDirFileEntry> &entries)
     d->entries = entries;
 }
 
+bool RpcDir::chunked() const
+{
+    Q_D(const RpcDir);
+    return d->chunked;
+}
+
+void RpcDir::setChunked(bool chunked)
+{
+    Q_D(RpcDir);
+    d->chunked = chunked;
+}
+
+QSharedPointer<RpcChunkStore> RpcDir::chunkStore() const
+{
+    Q_D(const RpcDir);
+    return d->chunkStore;
+}
+
+void RpcDir::setChunkStore(QSharedPointer<RpcChunkStore> chunkStore)
+{
+    Q_D(RpcDir);
+    d->chunkStore = chunkStore;
+}
+
+int RpcDir::concurrency() const
+{
+    Q_D(const RpcDir);
+    return d->concurrency;
+}
+
+void RpcDir::setConcurrency(int concurrency)
+{
+    Q_D(RpcDir);
+    d->concurrency = qMax(concurrency, 1);
+}
+
+quint64 RpcDir::packThreshold() const
+{
+    Q_D(const RpcDir);
+    return d->packThreshold;
+}
+
+void RpcDir::setPackThreshold(quint64 packThreshold)
+{
+    Q_D(RpcDir);
+    d->packThreshold = packThreshold;
+}
+
+bool RpcDir::memoryMapped() const
+{
+    Q_D(const RpcDir);
+    return d->memoryMapped;
+}
+
+void RpcDir::setMemoryMapped(bool memoryMapped)
+{
+    Q_D(RpcDir);
+    d->memoryMapped = memoryMapped;
+}
+
 QVariantMap RpcDir::saveState()
 {
     Q_D(const RpcDir);
@@ -483,6 +946,15 @@ QVariantMap RpcDir::saveState()
         entrieObjList.append(entryObj);
     }
     state.insert("entries", entrieObjList);
+    if (d->chunked) {
+        state.insert("chunked", true);
+    }
+    if (d->concurrency > 1) {
+        state.insert("concurrency", d->concurrency);
+    }
+    if (d->packThreshold > 0) {
+        state.insert("pack_threshold", d->packThreshold);
+    }
     return state;
 }
 
@@ -519,6 +991,9 @@ bool RpcDir::restoreState(const QVariantMap &state)
         entry.lastAccess = entryObj.value("atime").toDateTime();
         d->entries.append(entry);
     }
+    d->chunked = state.value("chunked").toBool();
+    d->concurrency = qMax(state.value("concurrency").toInt(), 1);
+    d->packThreshold = state.value("pack_threshold").toULongLong();
     return true;
 }
 
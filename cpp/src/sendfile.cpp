@@ -1,14 +1,24 @@
 #include "../include/sendfile.h"
+#include "../include/wrapped_socket_p.h"
+#include "../include/delta_p.h"
+#include "../include/chunkstore_p.h"
+#include "../include/zerocopy_p.h"
 #include <QtCore/qbuffer.h>
 #include <QtCore/qcryptographichash.h>
 #include <QtCore/qdebug.h>
+#include <QtCore/qendian.h>
 #include <QtCore/qfileinfo.h>
 #include <QtCore/qloggingcategory.h>
+#include <QtCore/qmap.h>
 #include <functional>
+#ifdef Q_OS_UNIX
+#  include <stdio.h>
+#endif
 
 static Q_LOGGING_CATEGORY(logger, "lafrpc.sendfile");
 using namespace qtng;
 const static qint64 BLOCK_SIZE = 1024 * 32;
+const static qint64 WRITE_SIZE = BLOCK_SIZE * 32;
 
 BEGIN_LAFRPC_NAMESPACE
 
@@ -18,11 +28,33 @@ public:
     RpcFilePrivate(RpcFile *q);
 public:
     bool sendfileViaChannel(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback);
-    bool recvfileViaChannel(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback,
-                            const QByteArray &header);
-    bool sendfileViaRawSocket(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback);
-    bool recvfileViaRawSocket(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback,
-                              const QByteArray &header);
+    bool recvfileViaChannel(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback);
+    bool sendfileViaRawSocket(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback, QFile *file);
+    qint64 sendfileInKernel(QFile *file, RpcFile::ProgressCallback progressCallback);
+    bool recvfileViaRawSocket(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback, QFile *file);
+    qint64 recvfileInKernel(QFile *file, RpcFile::ProgressCallback progressCallback);
+    static bool writeBuffered(QSharedPointer<FileLike> f, QByteArray *pending, const QByteArray &data);
+    static bool flushBuffered(QSharedPointer<FileLike> f, QByteArray *pending);
+    bool sendfileViaChannels(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback);
+    bool recvfileViaChannels(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback,
+                             QFile *positional);
+    int effectiveStreams() const;
+    bool writeTo(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback, QFile *file, bool resume);
+    bool readFrom(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback, QFile *file);
+    bool negotiateAsReceiver(QFile *file, bool resume);
+    bool negotiateAsSender(QSharedPointer<FileLike> f, QFile *file);
+    bool sendControl(const QByteArray &data);
+    QByteArray recvControl(qint32 size);
+    QSharedPointer<QCryptographicHash> takeHasher();
+    bool sendFrame(const QByteArray &data);
+    QByteArray recvFrame();
+    bool sendfileAsDelta(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback);
+    bool recvfileAsDelta(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback, QFile *basis);
+    bool writeToPathAsDelta(const QString &path, RpcFile::ProgressCallback progressCallback);
+    bool sendfileChunked(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback);
+    bool recvfileChunked(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback);
+    void waitForReceiver();
+    void acknowledge();
 public:
     QString filePath;
     QString name;
@@ -31,6 +63,16 @@ public:
     quint64 mtime;
     quint64 ctime;
     QByteArray hash;
+    bool hashWhileSending;
+    int streams;
+    bool resumable;
+    bool delta;
+    bool chunked;
+    QSharedPointer<RpcChunkStore> chunkStore;
+    quint64 offset;
+    QSharedPointer<QCryptographicHash> prefixHasher;
+    bool preallocate;
+    bool memoryMapped;
 private:
     RpcFile * const q_ptr;
     Q_DECLARE_PUBLIC(RpcFile)
@@ -41,6 +83,14 @@ RpcFilePrivate::RpcFilePrivate(RpcFile *q)
     , atime(0)
     , mtime(0)
     , ctime(0)
+    , hashWhileSending(false)
+    , streams(1)
+    , resumable(false)
+    , delta(false)
+    , chunked(false)
+    , offset(0)
+    , preallocate(false)
+    , memoryMapped(false)
     , q_ptr(q)
 {
 }
@@ -55,20 +105,24 @@ bool RpcFilePrivate::sendfileViaChannel(QSharedPointer<FileLike> f, RpcFile::Pro
     }
     q->channel->setCapacity(32);
 
-    quint64 count = 0;
-    QByteArray buf(BLOCK_SIZE, Qt::Uninitialized);
+    quint64 count = offset;
+    QSharedPointer<QCryptographicHash> hasher;
+    if (hashWhileSending) {
+        hasher = takeHasher();
+    }
     if (progressCallback) {
         while (count < size) {
-            qint64 readBytes = f->read(buf.data(), qMin<qint64>(BLOCK_SIZE, static_cast<qint64>(size - count)));
-            if (readBytes < 0) {
-                qCWarning(logger) << "rpc file read error.";
-                progressCallback(-1, count, size);
-                return false;
-            } else if (readBytes == 0) {
+            const QByteArray &buf =
+                    ZeroCopy::readPacket(f.data(), static_cast<qint32>(qMin<quint64>(BLOCK_SIZE, size - count)));
+            if (buf.isEmpty()) {
                 progressCallback(-1, count, size);
                 return false;
             }
-            bool success = q->channel->sendPacket(buf.left(readBytes));
+            const qint64 readBytes = buf.size();
+            if (hashWhileSending) {
+                hasher->addData(buf);
+            }
+            bool success = q->channel->sendPacket(buf);
             if (!success) {
                 qCDebug(logger) << "rpc file send error.";
                 progressCallback(-1, count, size);
@@ -83,14 +137,16 @@ bool RpcFilePrivate::sendfileViaChannel(QSharedPointer<FileLike> f, RpcFile::Pro
         }
     } else {
         while (count < size) {
-            qint64 readBytes = f->read(buf.data(), qMin<qint64>(BLOCK_SIZE, static_cast<qint64>(size - count)));
-            if (readBytes < 0) {
-                qCWarning(logger) << "rpc file read error.";
-                return false;
-            } else if (readBytes == 0) {
+            const QByteArray &buf =
+                    ZeroCopy::readPacket(f.data(), static_cast<qint32>(qMin<quint64>(BLOCK_SIZE, size - count)));
+            if (buf.isEmpty()) {
                 return false;
             }
-            bool success = q->channel->sendPacket(buf.left(readBytes));
+            const qint64 readBytes = buf.size();
+            if (hashWhileSending) {
+                hasher->addData(buf);
+            }
+            bool success = q->channel->sendPacket(buf);
             if (!success) {
                 qCDebug(logger) << "rpc file send error.";
                 return false;
@@ -100,12 +156,20 @@ bool RpcFilePrivate::sendfileViaChannel(QSharedPointer<FileLike> f, RpcFile::Pro
         }
     }
 
+    // the digest follows the last block as a trailer packet.
+    if (hashWhileSending) {
+        hash = hasher->result();
+        if (!q->channel->sendPacket(hash)) {
+            qCDebug(logger) << "rpc file send error.";
+            return false;
+        }
+    }
+
     q->channel->recvPacket();  // ensure all data sent.
     return true;
 }
 
-bool RpcFilePrivate::recvfileViaChannel(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback,
-                                        const QByteArray &header)
+bool RpcFilePrivate::recvfileViaChannel(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback)
 {
     Q_Q(RpcFile);
     if (size == 0) {
@@ -114,27 +178,25 @@ bool RpcFilePrivate::recvfileViaChannel(QSharedPointer<FileLike> f, RpcFile::Pro
         return true;
     }
     q->channel->setCapacity(32);
-    quint64 count = static_cast<quint64>(header.size());
+    quint64 count = offset;
     QSharedPointer<QCryptographicHash> hasher;
-    const bool doHash = !hash.isEmpty();
+    const bool doHash = !hash.isEmpty() || hashWhileSending;
     if (doHash) {
-        hasher.reset(new QCryptographicHash (QCryptographicHash::Sha256));
+        hasher = takeHasher();
     }
+    // the packets are gathered and written 1MB at a time.
+    QByteArray pending;
+    pending.reserve(static_cast<int>(WRITE_SIZE));
     if (progressCallback) {
         while (count < size) {
             const QByteArray &buf = q->channel->recvPacket();
             if (buf.isEmpty()) {
                 qCWarning(logger) << "rpc file receiving error." << q->channel->errorString();
+                flushBuffered(f, &pending);
                 progressCallback(-1, count, size);
                 return false;
             }
-            qint64 writtenBytes = f->write(buf);
-            if (writtenBytes < 0) {
-                qCWarning(logger) << "rpc file write error.";
-                progressCallback(-1, count, size);
-                return false;
-            } else if (writtenBytes != buf.size()) {
-                qCWarning(logger) << "rpc file write error: partial writing.";
+            if (!writeBuffered(f, &pending, buf)) {
                 progressCallback(-1, count, size);
                 return false;
             }
@@ -144,6 +206,7 @@ bool RpcFilePrivate::recvfileViaChannel(QSharedPointer<FileLike> f, RpcFile::Pro
             }
             bool keepGo = progressCallback(buf.size(), count, size);
             if (!keepGo) {
+                flushBuffered(f, &pending);
                 return false;
             }
         }
@@ -153,15 +216,10 @@ bool RpcFilePrivate::recvfileViaChannel(QSharedPointer<FileLike> f, RpcFile::Pro
             const QByteArray &buf = q->channel->recvPacket();
             if (buf.isEmpty()) {
                 qCWarning(logger) << "rpc file receiving error." << q->channel->errorString();
-                ;
+                flushBuffered(f, &pending);
                 return false;
             }
-            qint64 writtenBytes = f->write(buf);
-            if (writtenBytes < 0) {
-                qCWarning(logger) << "rpc file write error.";
-                return false;
-            } else if (writtenBytes != buf.size()) {
-                qCWarning(logger) << "rpc file write error: partial writing.";
+            if (!writeBuffered(f, &pending, buf)) {
                 return false;
             }
             count += static_cast<quint64>(buf.size());
@@ -170,9 +228,17 @@ bool RpcFilePrivate::recvfileViaChannel(QSharedPointer<FileLike> f, RpcFile::Pro
             }
         }
     }
+    if (!flushBuffered(f, &pending)) {
+        if (progressCallback)
+            progressCallback(-1, count, size);
+        return false;
+    }
 
     if (doHash) {
         const QByteArray &myHash = hasher->result();
+        if (hashWhileSending) {
+            hash = q->channel->recvPacket();
+        }
         if (myHash != hash) {
             qCDebug(logger) << "writeTo() got mismatched hash.";
             return false;
@@ -182,7 +248,35 @@ bool RpcFilePrivate::recvfileViaChannel(QSharedPointer<FileLike> f, RpcFile::Pro
     return true;
 }
 
-bool RpcFilePrivate::sendfileViaRawSocket(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback)
+bool RpcFilePrivate::writeBuffered(QSharedPointer<FileLike> f, QByteArray *pending, const QByteArray &data)
+{
+    pending->append(data);
+    if (pending->size() < WRITE_SIZE) {
+        return true;
+    }
+    return flushBuffered(f, pending);
+}
+
+bool RpcFilePrivate::flushBuffered(QSharedPointer<FileLike> f, QByteArray *pending)
+{
+    if (pending->isEmpty()) {
+        return true;
+    }
+    qint64 writtenBytes = f->write(*pending);
+    if (writtenBytes < 0) {
+        qCWarning(logger) << "rpc file write error.";
+        return false;
+    } else if (writtenBytes != pending->size()) {
+        qCWarning(logger) << "rpc file write error: partial writing.";
+        return false;
+    }
+    // keep the reserved capacity.
+    pending->resize(0);
+    return true;
+}
+
+bool RpcFilePrivate::sendfileViaRawSocket(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback,
+                                          QFile *file)
 {
     Q_Q(RpcFile);
     if (size == 0) {
@@ -190,45 +284,99 @@ bool RpcFilePrivate::sendfileViaRawSocket(QSharedPointer<FileLike> f, RpcFile::P
             progressCallback(-1, 0, 0);
         return false;
     }
-    if (progressCallback) {
-        quint64 count = 0;
+    const qint64 sentInKernel = hashWhileSending ? -1 : sendfileInKernel(file, progressCallback);
+    if (sentInKernel >= 0) {
+        if (static_cast<quint64>(sentInKernel) != size - offset) {
+            return false;
+        }
+    } else if (progressCallback || hashWhileSending) {
+        quint64 count = offset;
         QByteArray buf(BLOCK_SIZE, Qt::Uninitialized);
+        QSharedPointer<QCryptographicHash> hasher = takeHasher();
         while (count < size) {
             qint64 readBytes = f->read(buf.data(), qMin<qint64>(BLOCK_SIZE, static_cast<qint64>(size - count)));
             if (readBytes < 0) {
                 qCWarning(logger) << "rpc file read error.";
-                progressCallback(-1, count, size);
+                if (progressCallback)
+                    progressCallback(-1, count, size);
                 return false;
             } else if (readBytes == 0) {
-                progressCallback(-1, count, size);
+                if (progressCallback)
+                    progressCallback(-1, count, size);
                 return false;
             }
+            if (hashWhileSending) {
+                hasher->addData(buf.constData(), static_cast<int>(readBytes));
+            }
             // TODO use send() instead of sendall() to maxium the boundrate.
-            qint32 bs = q->rawSocket->sendall(buf.left(readBytes));
+            qint32 bs = q->rawSocket->sendall(buf.constData(), static_cast<qint32>(readBytes));
             if (bs != readBytes) {
                 qCDebug(logger) << "rpc file send error.";
-                progressCallback(-1, count, size);
+                if (progressCallback)
+                    progressCallback(-1, count, size);
                 return false;
             } else {
                 count += static_cast<quint64>(readBytes);
-                bool keepGo = progressCallback(readBytes, count, size);
-                if (!keepGo) {
+                if (progressCallback && !progressCallback(readBytes, count, size)) {
                     return false;
                 }
             }
         }
+        // the sha256 digest is a fixed 32-byte trailer after the content.
+        if (hashWhileSending) {
+            hash = hasher->result();
+            if (q->rawSocket->sendall(hash) != hash.size()) {
+                qCDebug(logger) << "rpc file send error.";
+                return false;
+            }
+        }
     } else {
-        if (!sendfile(f, q->rawSocket, size)) {
+        if (!sendfile(f, q->rawSocket, size - offset)) {
             return false;
         }
     }
 
-    q->rawSocket->recv(1);
+    // the receiver acknowledges with one byte, then both sides can reuse the raw socket.
+    if (q->rawSocket->recv(1).size() == 1) {
+        RecyclableSocket::markReusable(q->rawSocket);
+    }
     return true;
 }
 
+// the file content goes from the page cache to the plain socket directly, the progress is reported every 1MB.
+// return -1 if the kernel can not do it, then nothing is sent.
+qint64 RpcFilePrivate::sendfileInKernel(QFile *file, RpcFile::ProgressCallback progressCallback)
+{
+    Q_Q(RpcFile);
+    const qintptr socketFd = PlainSocket::plainFileno(q->rawSocket);
+    if (!file || file->handle() < 0 || socketFd < 0) {
+        return -1;
+    }
+    quint64 count = offset;
+    while (count < size) {
+        const qint64 want = qMin<qint64>(WRITE_SIZE, static_cast<qint64>(size - count));
+        const qint64 bs = ZeroCopy::sendfile(file->handle(), static_cast<qint64>(count), socketFd, want);
+        if (bs < 0 && count == offset) {
+            return -1;
+        }
+        if (bs > 0) {
+            count += static_cast<quint64>(bs);
+        }
+        if (bs != want) {
+            qCDebug(logger) << "rpc file send error.";
+            if (progressCallback)
+                progressCallback(-1, count, size);
+            break;
+        }
+        if (progressCallback && !progressCallback(bs, count, size)) {
+            break;
+        }
+    }
+    return static_cast<qint64>(count - offset);
+}
+
 bool RpcFilePrivate::recvfileViaRawSocket(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback,
-                                          const QByteArray &header)
+                                          QFile *file)
 {
     Q_Q(RpcFile);
     if (size == 0) {
@@ -236,53 +384,1003 @@ bool RpcFilePrivate::recvfileViaRawSocket(QSharedPointer<FileLike> f, RpcFile::P
             progressCallback(0, 0, 0);
         return true;
     }
-    quint64 count = static_cast<quint64>(header.size());
-    QCryptographicHash hasher(QCryptographicHash::Sha256);
-    const bool doHash = !hash.isEmpty();
-    if (progressCallback) {
+    quint64 count = offset;
+    const bool doHash = !hash.isEmpty() || hashWhileSending;
+    QSharedPointer<QCryptographicHash> hasher = takeHasher();
+    // the hash needs the content in user space.
+    const qint64 receivedInKernel = doHash ? -1 : recvfileInKernel(file, progressCallback);
+    if (receivedInKernel >= 0) {
+        if (static_cast<quint64>(receivedInKernel) != size - offset) {
+            return false;
+        }
+    } else if (progressCallback || doHash) {
+        QByteArray buf(static_cast<int>(WRITE_SIZE), Qt::Uninitialized);
         while (count < size) {
-            const QByteArray &buf = q->rawSocket->recv(1024);
-            if (buf.isEmpty()) {
+            // never read past the content, the trailer follows it.
+            qint32 bs = q->rawSocket->recv(buf.data(), static_cast<qint32>(qMin<quint64>(WRITE_SIZE, size - count)));
+            if (bs <= 0) {
                 qCWarning(logger) << "rpc file receiving error.";
-                progressCallback(-1, count, size);
+                if (progressCallback)
+                    progressCallback(-1, count, size);
                 return false;
             }
-            qint64 writtenBytes = f->write(buf);
+            qint64 writtenBytes = f->write(buf.constData(), bs);
             if (writtenBytes < 0) {
                 qCWarning(logger) << "rpc file write error.";
-                progressCallback(-1, count, size);
+                if (progressCallback)
+                    progressCallback(-1, count, size);
                 return false;
-            } else if (writtenBytes != buf.size()) {
+            } else if (writtenBytes != bs) {
                 qCWarning(logger) << "rpc file write error: partial writing.";
-                progressCallback(-1, count, size);
+                if (progressCallback)
+                    progressCallback(-1, count, size);
                 return false;
             }
-            count += static_cast<quint64>(buf.size());
+            count += static_cast<quint64>(bs);
             if (doHash) {
-                hasher.addData(buf);
+                hasher->addData(buf.constData(), bs);
             }
-            bool keepGo = progressCallback(buf.size(), count, size);
-            if (!keepGo) {
+            if (progressCallback && !progressCallback(bs, count, size)) {
                 return false;
             }
         }
     } else {
-        if (!sendfile(q->rawSocket, f, size)) {
+        if (!sendfile(q->rawSocket, f, size - offset)) {
             return false;
         }
     }
     if (doHash) {
-        const QByteArray &myHash = hasher.result();
+        const QByteArray &myHash = hasher->result();
+        if (hashWhileSending) {
+            hash = q->rawSocket->recvall(myHash.size());
+        }
         if (myHash != hash) {
             qCDebug(logger) << "recvfile() got mismatched hash.";
             return false;
         }
     }
+    if (q->rawSocket->sendall("\x01", 1) == 1) {
+        RecyclableSocket::markReusable(q->rawSocket);
+    }
     // TODO set times.
     return true;
 }
 
-RpcFile::RpcFile(const QString &filePath, bool withHash)
+// the content goes from the plain socket to the page cache through a pipe, the progress is reported every 1MB.
+// return -1 if the kernel can not do it, then nothing is received.
+qint64 RpcFilePrivate::recvfileInKernel(QFile *file, RpcFile::ProgressCallback progressCallback)
+{
+    Q_Q(RpcFile);
+    const qintptr socketFd = PlainSocket::plainFileno(q->rawSocket);
+    if (!file || file->handle() < 0 || socketFd < 0) {
+        return -1;
+    }
+    quint64 count = offset;
+    while (count < size) {
+        const qint64 want = qMin<qint64>(WRITE_SIZE, static_cast<qint64>(size - count));
+        const qint64 bs = ZeroCopy::splice(socketFd, file->handle(), static_cast<qint64>(count), want);
+        if (bs < 0 && count == offset) {
+            return -1;
+        }
+        if (bs > 0) {
+            count += static_cast<quint64>(bs);
+        }
+        if (bs != want) {
+            qCWarning(logger) << "rpc file receiving error.";
+            if (progressCallback)
+                progressCallback(-1, count, size);
+            break;
+        }
+        if (progressCallback && !progressCallback(bs, count, size)) {
+            break;
+        }
+    }
+    return static_cast<qint64>(count - offset);
+}
+
+// blocks are spread over the sub channels, each one starts with its 8-byte offset in the file.
+bool RpcFilePrivate::sendfileViaChannels(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback)
+{
+    Q_Q(RpcFile);
+    const int streams = effectiveStreams();
+    QList<QSharedPointer<VirtualChannel>> subChannels;
+    for (int i = 0; i < streams; ++i) {
+        QSharedPointer<VirtualChannel> subChannel = q->channel->makeChannel();
+        if (subChannel.isNull()) {
+            qCDebug(logger) << "can not make sub channel for rpc file.";
+            if (progressCallback)
+                progressCallback(-1, 0, size);
+            return false;
+        }
+        subChannel->setCapacity(32);
+        subChannels.append(subChannel);
+    }
+
+    QSharedPointer<QCryptographicHash> hasher;
+    if (hashWhileSending) {
+        hasher = takeHasher();
+    }
+    quint64 nextOffset = offset;
+    quint64 count = offset;
+    bool failed = false;
+    CoroutineGroup operations;
+    for (QSharedPointer<VirtualChannel> subChannel : subChannels) {
+        operations.spawn([this, f, progressCallback, subChannel, hasher, &nextOffset, &count, &failed] {
+            while (!failed && nextOffset < size) {
+                // reading file never switches coroutines, so the blocks are read and hashed in order.
+                const quint64 blockOffset = nextOffset;
+                const qint64 blockSize = qMin<qint64>(BLOCK_SIZE, static_cast<qint64>(size - blockOffset));
+                QByteArray packet(static_cast<int>(blockSize) + 8, Qt::Uninitialized);
+                qToBigEndian<quint64>(blockOffset, reinterpret_cast<uchar *>(packet.data()));
+                qint64 readBytes = f->read(packet.data() + 8, blockSize);
+                if (readBytes <= 0) {
+                    qCWarning(logger) << "rpc file read error.";
+                    if (progressCallback)
+                        progressCallback(-1, count, size);
+                    failed = true;
+                    return;
+                }
+                packet.resize(static_cast<int>(readBytes) + 8);
+                nextOffset += static_cast<quint64>(readBytes);
+                if (hasher) {
+                    hasher->addData(packet.constData() + 8, static_cast<int>(readBytes));
+                }
+                if (!subChannel->sendPacket(packet)) {
+                    qCDebug(logger) << "rpc file send error.";
+                    if (progressCallback)
+                        progressCallback(-1, count, size);
+                    failed = true;
+                    return;
+                }
+                count += static_cast<quint64>(readBytes);
+                if (progressCallback && !progressCallback(readBytes, count, size)) {
+                    failed = true;
+                    return;
+                }
+            }
+        });
+    }
+    operations.joinall();
+    if (failed) {
+        return false;
+    }
+
+    if (hashWhileSending) {
+        hash = hasher->result();
+        if (!q->channel->sendPacket(hash)) {
+            qCDebug(logger) << "rpc file send error.";
+            return false;
+        }
+    }
+    q->channel->recvPacket();  // ensure all data sent.
+    return true;
+}
+
+// with a positional file, the blocks are written where they belong, and the hash is read back from the file as the
+// prefix without gaps grows. otherwise, the blocks arrived early wait for the blocks before them, and a stream runs
+// ahead no further than the window of all streams. the hash is always calculated in order.
+bool RpcFilePrivate::recvfileViaChannels(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback,
+                                         QFile *positional)
+{
+    Q_Q(RpcFile);
+    const int streams = effectiveStreams();
+    QList<QSharedPointer<VirtualChannel>> subChannels;
+    for (int i = 0; i < streams; ++i) {
+        QSharedPointer<VirtualChannel> subChannel = q->channel->takeChannel();
+        if (subChannel.isNull()) {
+            qCWarning(logger) << "rpc file receiving error: sub channel is gone.";
+            if (progressCallback)
+                progressCallback(-1, 0, size);
+            return false;
+        }
+        subChannel->setCapacity(32);
+        subChannels.append(subChannel);
+    }
+
+    QSharedPointer<QCryptographicHash> hasher;
+    const bool doHash = !hash.isEmpty() || hashWhileSending;
+    if (doHash) {
+        hasher = takeHasher();
+    }
+    QSharedPointer<QFile> readBack;
+    if (positional && hasher) {
+        readBack.reset(new QFile(positional->fileName()));
+        if (!readBack->open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+            qCWarning(logger) << "can not read back rpc file for hashing:" << positional->fileName();
+            if (progressCallback)
+                progressCallback(-1, 0, size);
+            return false;
+        }
+    }
+    // the blocks after the watermark, by offset. the file has no gap before the watermark.
+    QMap<quint64, quint64> arrived;
+    quint64 watermark = offset;
+    quint64 hashed = offset;
+    QMap<quint64, QByteArray> pending;
+    const int maxPending = streams * 32;
+    Event drained;
+    quint64 count = offset;
+    bool failed = false;
+    Event done;
+    CoroutineGroup operations;
+    for (QSharedPointer<VirtualChannel> subChannel : subChannels) {
+        operations.spawn([this, f, progressCallback, positional, subChannel, hasher, readBack, maxPending, &arrived,
+                          &watermark, &hashed, &pending, &drained, &count, &failed, &done] {
+            auto fail = [&] {
+                if (progressCallback)
+                    progressCallback(-1, count, size);
+                failed = true;
+                done.set();
+            };
+            while (true) {
+                const QByteArray &packet = subChannel->recvPacket();
+                if (packet.size() <= 8) {
+                    qCWarning(logger) << "rpc file receiving error." << subChannel->errorString();
+                    return fail();
+                }
+                const quint64 offset = qFromBigEndian<quint64>(reinterpret_cast<const uchar *>(packet.constData()));
+                const QByteArray &block = packet.mid(8);
+                const quint64 end = offset + static_cast<quint64>(block.size());
+                if (end > size) {
+                    qCWarning(logger) << "rpc file receiving error: block out of range.";
+                    return fail();
+                }
+                // a repeated or overlapping block would count twice and leave a hole.
+                QMap<quint64, quint64>::const_iterator itor = arrived.lowerBound(offset);
+                bool overlapped = offset < watermark || (itor != arrived.constEnd() && itor.key() < end);
+                if (!overlapped && itor != arrived.constBegin()) {
+                    --itor;
+                    overlapped = itor.key() + itor.value() > offset;
+                }
+                if (overlapped) {
+                    qCWarning(logger) << "rpc file receiving error: block overlaps the received ones.";
+                    return fail();
+                }
+                if (positional) {
+                    if (!positional->seek(static_cast<qint64>(offset)) || positional->write(block) != block.size()) {
+                        qCWarning(logger) << "rpc file write error.";
+                        return fail();
+                    }
+                } else {
+                    pending.insert(offset, block);
+                }
+                arrived.insert(offset, static_cast<quint64>(block.size()));
+                const quint64 oldWatermark = watermark;
+                while (!arrived.isEmpty() && arrived.firstKey() == watermark) {
+                    if (!positional) {
+                        const QByteArray next = pending.take(watermark);
+                        if (f->write(next) != next.size()) {
+                            qCWarning(logger) << "rpc file write error: partial writing.";
+                            return fail();
+                        }
+                        if (hasher) {
+                            hasher->addData(next);
+                        }
+                    }
+                    watermark += arrived.take(watermark);
+                }
+                if (!readBack.isNull()) {
+                    QByteArray buf(BLOCK_SIZE, Qt::Uninitialized);
+                    while (hashed < watermark) {
+                        const qint64 n = qMin<qint64>(BLOCK_SIZE, static_cast<qint64>(watermark - hashed));
+                        if (!readBack->seek(static_cast<qint64>(hashed)) || readBack->read(buf.data(), n) != n) {
+                            qCWarning(logger) << "rpc file read error while hashing.";
+                            return fail();
+                        }
+                        hasher->addData(buf.constData(), static_cast<int>(n));
+                        hashed += static_cast<quint64>(n);
+                    }
+                }
+                if (watermark != oldWatermark) {
+                    drained.set();
+                }
+                count += static_cast<quint64>(block.size());
+                if (progressCallback && !progressCallback(block.size(), count, size)) {
+                    failed = true;
+                    done.set();
+                    return;
+                }
+                if (watermark >= size) {
+                    done.set();
+                    return;
+                }
+                // the offsets of one stream only grow. a stream ahead of the watermark can not carry the block the
+                // others wait for, so it waits while the buffer is full.
+                while (pending.size() >= maxPending && offset > watermark) {
+                    drained.clear();
+                    drained.tryWait();
+                }
+            }
+        });
+    }
+    done.tryWait();
+    operations.killall();
+    for (QSharedPointer<VirtualChannel> subChannel : subChannels) {
+        subChannel->close();
+    }
+    if (failed) {
+        // keep only the prefix without gaps, so the next writeToPath() can resume from it.
+        if (positional && static_cast<quint64>(positional->size()) > watermark) {
+            positional->resize(static_cast<qint64>(watermark));
+        }
+        return false;
+    }
+
+    if (doHash) {
+        const QByteArray &myHash = hasher->result();
+        if (hashWhileSending) {
+            hash = q->channel->recvPacket();
+        }
+        if (myHash != hash) {
+            qCDebug(logger) << "writeTo() got mismatched hash.";
+            return false;
+        }
+    }
+    return true;
+}
+
+int RpcFilePrivate::effectiveStreams() const
+{
+    if (delta || chunked) {
+        return 1;
+    }
+    // every stream should get at least a full window of blocks.
+    const quint64 maxStreams = qMax<quint64>(size / static_cast<quint64>(BLOCK_SIZE * 32), 1);
+    return static_cast<int>(qMin<quint64>(static_cast<quint64>(qMax(streams, 1)), maxStreams));
+}
+
+// hash the first n bytes of the file in a thread, return nullptr if the file is shorter.
+static QSharedPointer<QCryptographicHash> hashPrefix(const QString &filePath, quint64 n)
+{
+    typedef QSharedPointer<QCryptographicHash> Hasher;
+    return callInThread<Hasher>([filePath, n]() -> Hasher {
+        QFile f(filePath);
+        if (!f.open(QIODevice::ReadOnly)) {
+            return Hasher();
+        }
+        Hasher hasher(new QCryptographicHash(QCryptographicHash::Sha256));
+        QByteArray buf(BLOCK_SIZE, Qt::Uninitialized);
+        quint64 count = 0;
+        while (count < n) {
+            qint64 readBytes = f.read(buf.data(), qMin<qint64>(BLOCK_SIZE, static_cast<qint64>(n - count)));
+            if (readBytes <= 0) {
+                return Hasher();
+            }
+            hasher->addData(buf.constData(), static_cast<int>(readBytes));
+            count += static_cast<quint64>(readBytes);
+        }
+        return hasher;
+    });
+}
+
+bool RpcFilePrivate::sendControl(const QByteArray &data)
+{
+    Q_Q(RpcFile);
+    if (q->rawSocket.isNull()) {
+        return q->channel->sendPacket(data);
+    } else {
+        return q->rawSocket->sendall(data) == data.size();
+    }
+}
+
+QByteArray RpcFilePrivate::recvControl(qint32 size)
+{
+    Q_Q(RpcFile);
+    const QByteArray &data = q->rawSocket.isNull() ? q->channel->recvPacket() : q->rawSocket->recvall(size);
+    if (data.size() != size) {
+        return QByteArray();
+    }
+    return data;
+}
+
+// the sha256 of the resumed prefix goes on with the rest of content.
+QSharedPointer<QCryptographicHash> RpcFilePrivate::takeHasher()
+{
+    QSharedPointer<QCryptographicHash> hasher = prefixHasher;
+    prefixHasher.reset();
+    if (hasher.isNull()) {
+        hasher.reset(new QCryptographicHash(QCryptographicHash::Sha256));
+    }
+    return hasher;
+}
+
+// the receiver tells how many bytes it holds with the sha256 of them, and the sender answers the offset to go on.
+// the offset is 0 if the prefix is not the same.
+bool RpcFilePrivate::negotiateAsReceiver(QFile *file, bool resume)
+{
+    offset = 0;
+    prefixHasher.reset();
+    quint64 held = 0;
+    if (resume && file) {
+        held = qMin<quint64>(static_cast<quint64>(file->size()), size);
+        if (held > 0) {
+            prefixHasher = hashPrefix(file->fileName(), held);
+            if (prefixHasher.isNull()) {
+                held = 0;
+            }
+        }
+    }
+    QByteArray request(8, Qt::Uninitialized);
+    qToBigEndian<quint64>(held, reinterpret_cast<uchar *>(request.data()));
+    if (!sendControl(request) || (held > 0 && !sendControl(prefixHasher->result()))) {
+        return false;
+    }
+    const QByteArray &reply = recvControl(8);
+    if (reply.isEmpty()) {
+        return false;
+    }
+    const quint64 accepted = qFromBigEndian<quint64>(reinterpret_cast<const uchar *>(reply.constData()));
+    if (accepted == 0) {
+        prefixHasher.reset();
+    } else if (accepted != held) {
+        qCWarning(logger) << "rpc file got invalid offset:" << accepted;
+        return false;
+    }
+    offset = accepted;
+    if (file) {
+        if (static_cast<quint64>(file->size()) != offset && !file->resize(static_cast<qint64>(offset))) {
+            return false;
+        }
+        if (!file->seek(static_cast<qint64>(offset))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RpcFilePrivate::negotiateAsSender(QSharedPointer<FileLike> f, QFile *file)
+{
+    offset = 0;
+    prefixHasher.reset();
+    const QByteArray &request = recvControl(8);
+    if (request.isEmpty()) {
+        return false;
+    }
+    const quint64 held = qFromBigEndian<quint64>(reinterpret_cast<const uchar *>(request.constData()));
+    if (held > size) {
+        qCWarning(logger) << "rpc file got invalid offset:" << held;
+        return false;
+    }
+    quint64 accepted = 0;
+    if (held > 0) {
+        const QByteArray &theirHash = recvControl(32);
+        if (theirHash.isEmpty()) {
+            return false;
+        }
+        QSharedPointer<QCryptographicHash> hasher;
+        if (file) {
+            hasher = hashPrefix(file->fileName(), held);
+        } else {
+            // can not seek the file, so read the prefix through.
+            hasher.reset(new QCryptographicHash(QCryptographicHash::Sha256));
+            QByteArray buf(BLOCK_SIZE, Qt::Uninitialized);
+            quint64 count = 0;
+            while (count < held) {
+                qint64 readBytes = f->read(buf.data(), qMin<qint64>(BLOCK_SIZE, static_cast<qint64>(held - count)));
+                if (readBytes <= 0) {
+                    qCWarning(logger) << "rpc file read error.";
+                    return false;
+                }
+                hasher->addData(buf.constData(), static_cast<int>(readBytes));
+                count += static_cast<quint64>(readBytes);
+            }
+        }
+        if (!hasher.isNull() && hasher->result() == theirHash) {
+            accepted = held;
+            prefixHasher = hasher;
+        } else if (!file) {
+            qCWarning(logger) << "can not resume rpc file: the prefix is different.";
+            return false;
+        }
+    }
+    QByteArray reply(8, Qt::Uninitialized);
+    qToBigEndian<quint64>(accepted, reinterpret_cast<uchar *>(reply.data()));
+    if (!sendControl(reply)) {
+        return false;
+    }
+    if (file && !file->seek(static_cast<qint64>(accepted))) {
+        return false;
+    }
+    // the mapped file keeps its own position.
+    QSharedPointer<MappedFile> mapped = f.dynamicCast<MappedFile>();
+    if (!mapped.isNull() && !mapped->seek(static_cast<qint64>(accepted))) {
+        return false;
+    }
+    offset = accepted;
+    return true;
+}
+
+bool RpcFilePrivate::sendFrame(const QByteArray &data)
+{
+    Q_Q(RpcFile);
+    if (q->rawSocket.isNull()) {
+        return q->channel->sendPacket(data);
+    }
+    QByteArray frame(4, Qt::Uninitialized);
+    qToBigEndian<quint32>(static_cast<quint32>(data.size()), reinterpret_cast<uchar *>(frame.data()));
+    frame.append(data);
+    return q->rawSocket->sendall(frame) == frame.size();
+}
+
+QByteArray RpcFilePrivate::recvFrame()
+{
+    Q_Q(RpcFile);
+    if (q->rawSocket.isNull()) {
+        return q->channel->recvPacket();
+    }
+    const QByteArray &header = q->rawSocket->recvall(4);
+    if (header.size() != 4) {
+        return QByteArray();
+    }
+    const quint32 frameSize = qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(header.constData()));
+    if (frameSize == 0 || frameSize > BLOCK_SIZE * 4) {
+        return QByteArray();
+    }
+    const QByteArray &frame = q->rawSocket->recvall(static_cast<qint32>(frameSize));
+    if (frame.size() != static_cast<int>(frameSize)) {
+        return QByteArray();
+    }
+    return frame;
+}
+
+// the receiver sends the signatures of old file, the sender answers a list of operations:
+//   'L' + length + bytes: the literal data.
+//   'C' + index: copy the block of old file.
+//   'E' + sha256: the end of new file.
+bool RpcFilePrivate::sendfileAsDelta(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback)
+{
+    Q_Q(RpcFile);
+    DeltaSignatures signatures;
+    const QByteArray &header = recvFrame();
+    if (header.size() != 8) {
+        qCDebug(logger) << "can not receive delta signatures.";
+        if (progressCallback)
+            progressCallback(-1, 0, size);
+        return false;
+    }
+    const quint32 blockSize = qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(header.constData()));
+    const quint32 blocks = qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(header.constData() + 4));
+    if (!DeltaSignatures::isValid(blockSize, blocks)) {
+        qCWarning(logger) << "got invalid delta signatures:" << blockSize << blocks;
+        if (progressCallback)
+            progressCallback(-1, 0, size);
+        return false;
+    }
+    const int entriesSize = static_cast<int>(blocks) * DeltaSignatures::EntrySize;
+    QByteArray entries;
+    while (entries.size() < entriesSize) {
+        const QByteArray &frame = recvFrame();
+        // the frames must end exactly at the count in header.
+        if (frame.isEmpty() || frame.size() > entriesSize - entries.size()) {
+            qCDebug(logger) << "can not receive delta signatures.";
+            if (progressCallback)
+                progressCallback(-1, 0, size);
+            return false;
+        }
+        entries.append(frame);
+    }
+    if (!signatures.restore(blockSize, blocks, entries)) {
+        if (progressCallback)
+            progressCallback(-1, 0, size);
+        return false;
+    }
+    entries.clear();
+
+    QCryptographicHash hasher(QCryptographicHash::Sha256);
+    QByteArray ops;
+    QByteArray data;
+    quint64 count = 0;
+    quint64 reported = 0;
+    bool failed = false;
+
+    auto flushOps = [&]() -> bool {
+        if (ops.isEmpty()) {
+            return true;
+        }
+        if (!sendFrame(ops)) {
+            qCDebug(logger) << "rpc file send error.";
+            failed = true;
+            return false;
+        }
+        ops.clear();
+        if (progressCallback && count > reported) {
+            const qint64 bs = static_cast<qint64>(count - reported);
+            reported = count;
+            if (!progressCallback(bs, count, size)) {
+                failed = true;
+                return false;
+            }
+        }
+        return true;
+    };
+    auto appendOp = [&](char op, quint32 value) {
+        char buf[5];
+        buf[0] = op;
+        qToBigEndian<quint32>(value, reinterpret_cast<uchar *>(buf + 1));
+        ops.append(buf, 5);
+    };
+    auto appendLiteral = [&](const char *literal, int length) -> bool {
+        while (length > 0) {
+            const int n = qMin<int>(length, BLOCK_SIZE);
+            appendOp('L', static_cast<quint32>(n));
+            ops.append(literal, n);
+            literal += n;
+            length -= n;
+            if (ops.size() >= BLOCK_SIZE && !flushOps()) {
+                return false;
+            }
+        }
+        return true;
+    };
+    // read until there are at least n bytes, or the end of file.
+    auto fill = [&](int n) -> bool {
+        while (data.size() < n && count < size) {
+            const int old = data.size();
+            const qint64 want = qMin<qint64>(BLOCK_SIZE, static_cast<qint64>(size - count));
+            data.resize(old + static_cast<int>(want));
+            qint64 readBytes = f->read(data.data() + old, want);
+            if (readBytes <= 0) {
+                qCWarning(logger) << "rpc file read error.";
+                failed = true;
+                return false;
+            }
+            data.resize(old + static_cast<int>(readBytes));
+            hasher.addData(data.constData() + old, static_cast<int>(readBytes));
+            count += static_cast<quint64>(readBytes);
+        }
+        return true;
+    };
+
+    const int L = static_cast<int>(signatures.blockSize);
+    RollingChecksum checksum;
+    bool rolling = false;
+    int pos = 0;
+    while (!failed) {
+        if (!fill(pos + L + 1)) {
+            break;
+        }
+        if (signatures.count() == 0 || data.size() - pos < L) {
+            if (count >= size) {
+                break;
+            }
+            // no block can match, send everything as literal data.
+            if (!appendLiteral(data.constData(), data.size())) {
+                break;
+            }
+            data.clear();
+            pos = 0;
+            rolling = false;
+            continue;
+        }
+        if (!rolling) {
+            checksum.reset(data.constData() + pos, static_cast<quint32>(L));
+            rolling = true;
+        }
+        const qint64 block = signatures.find(checksum.value(), data.constData() + pos);
+        if (block >= 0) {
+            if (!appendLiteral(data.constData(), pos)) {
+                break;
+            }
+            appendOp('C', static_cast<quint32>(block));
+            if (ops.size() >= BLOCK_SIZE && !flushOps()) {
+                break;
+            }
+            data.remove(0, pos + L);
+            pos = 0;
+            rolling = false;
+        } else if (data.size() - pos > L) {
+            checksum.roll(static_cast<uchar>(data.at(pos)), static_cast<uchar>(data.at(pos + L)));
+            ++pos;
+            if (pos >= BLOCK_SIZE * 32) {
+                if (!appendLiteral(data.constData(), pos)) {
+                    break;
+                }
+                data.remove(0, pos);
+                pos = 0;
+            }
+        } else {
+            break;
+        }
+    }
+    if (failed || !appendLiteral(data.constData(), data.size())) {
+        if (progressCallback)
+            progressCallback(-1, count, size);
+        return false;
+    }
+    hash = hasher.result();
+    ops.append('E');
+    ops.append(hash);
+    if (!flushOps()) {
+        if (progressCallback)
+            progressCallback(-1, count, size);
+        return false;
+    }
+    waitForReceiver();
+    return true;
+}
+
+bool RpcFilePrivate::recvfileAsDelta(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback,
+                                     QFile *basis)
+{
+    Q_Q(RpcFile);
+    DeltaSignatures signatures;
+    if (basis) {
+        const QString &basisPath = basis->fileName();
+        signatures = callInThread<DeltaSignatures>(
+                [basisPath]() -> DeltaSignatures { return DeltaSignatures::calculate(basisPath); });
+    }
+    QByteArray header(8, Qt::Uninitialized);
+    qToBigEndian<quint32>(signatures.blockSize, reinterpret_cast<uchar *>(header.data()));
+    qToBigEndian<quint32>(signatures.count(), reinterpret_cast<uchar *>(header.data() + 4));
+    bool success = sendFrame(header);
+    const QByteArray &entries = signatures.save();
+    for (int i = 0; success && i < entries.size(); i += BLOCK_SIZE) {
+        success = sendFrame(entries.mid(i, BLOCK_SIZE));
+    }
+    if (!success) {
+        qCDebug(logger) << "can not send delta signatures.";
+        if (progressCallback)
+            progressCallback(-1, 0, size);
+        return false;
+    }
+
+    QCryptographicHash hasher(QCryptographicHash::Sha256);
+    QByteArray block(static_cast<int>(signatures.blockSize), Qt::Uninitialized);
+    quint64 count = 0;
+    auto write = [&](const char *data, int length) -> bool {
+        if (count + static_cast<quint64>(length) > size || f->write(data, length) != length) {
+            qCWarning(logger) << "rpc file write error.";
+            return false;
+        }
+        hasher.addData(data, length);
+        count += static_cast<quint64>(length);
+        return true;
+    };
+    while (true) {
+        const QByteArray &frame = recvFrame();
+        if (frame.isEmpty()) {
+            qCWarning(logger) << "rpc file receiving error.";
+            if (progressCallback)
+                progressCallback(-1, count, size);
+            return false;
+        }
+        const quint64 before = count;
+        const char *p = frame.constData();
+        const char *end = p + frame.size();
+        bool ok = true;
+        while (ok && p < end) {
+            const char op = *p;
+            if (op == 'E') {
+                if (end - p != 33 || count != size) {
+                    ok = false;
+                    break;
+                }
+                const QByteArray &myHash = hasher.result();
+                if (myHash != QByteArray(p + 1, 32)) {
+                    qCDebug(logger) << "writeTo() got mismatched hash.";
+                    return false;
+                }
+                hash = myHash;
+                if (progressCallback && count > before && !progressCallback(count - before, count, size)) {
+                    return false;
+                }
+                acknowledge();
+                return true;
+            }
+            if (end - p < 5) {
+                ok = false;
+                break;
+            }
+            const quint32 value = qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(p + 1));
+            p += 5;
+            if (op == 'L') {
+                ok = value <= static_cast<quint32>(end - p) && write(p, static_cast<int>(value));
+                p += value;
+            } else if (op == 'C') {
+                ok = basis && value < signatures.count()
+                        && basis->seek(static_cast<qint64>(value) * static_cast<qint64>(signatures.blockSize))
+                        && basis->read(block.data(), block.size()) == block.size()
+                        && write(block.constData(), block.size());
+            } else {
+                ok = false;
+            }
+        }
+        if (!ok) {
+            qCWarning(logger) << "rpc file got invalid delta.";
+            if (progressCallback)
+                progressCallback(-1, count, size);
+            return false;
+        }
+        if (progressCallback && !progressCallback(static_cast<qint64>(count - before), count, size)) {
+            return false;
+        }
+    }
+}
+
+// the sender waits for the receiver, then the raw socket can be reused.
+void RpcFilePrivate::waitForReceiver()
+{
+    Q_Q(RpcFile);
+    if (q->rawSocket.isNull()) {
+        q->channel->recvPacket();  // ensure all data sent.
+    } else if (q->rawSocket->recv(1).size() == 1) {
+        RecyclableSocket::markReusable(q->rawSocket);
+    }
+}
+
+void RpcFilePrivate::acknowledge()
+{
+    Q_Q(RpcFile);
+    if (!q->rawSocket.isNull() && q->rawSocket->sendall("\x01", 1) == 1) {
+        RecyclableSocket::markReusable(q->rawSocket);
+    }
+}
+
+bool RpcFilePrivate::sendfileChunked(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback)
+{
+    quint64 count = 0;
+    bool aborted = false;
+    QByteArray digest;
+    bool success = ChunkedTransfer::send(
+            f, size, [this](const QByteArray &frame) { return sendFrame(frame); }, [this] { return recvFrame(); },
+            [this, progressCallback, &count, &aborted](qint64 bs) {
+                count += static_cast<quint64>(bs);
+                aborted = progressCallback && !progressCallback(bs, count, size);
+                return !aborted;
+            },
+            &digest);
+    if (!success) {
+        if (progressCallback && !aborted)
+            progressCallback(-1, count, size);
+        return false;
+    }
+    hash = digest;
+    waitForReceiver();
+    return true;
+}
+
+bool RpcFilePrivate::recvfileChunked(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback)
+{
+    quint64 count = 0;
+    bool aborted = false;
+    QByteArray digest;
+    bool success = ChunkedTransfer::recv(
+            f, size, chunkStore, [this](const QByteArray &frame) { return sendFrame(frame); },
+            [this] { return recvFrame(); },
+            [this, progressCallback, &count, &aborted](qint64 bs) {
+                count += static_cast<quint64>(bs);
+                aborted = progressCallback && !progressCallback(bs, count, size);
+                return !aborted;
+            },
+            &digest);
+    if (!success) {
+        if (progressCallback && !aborted)
+            progressCallback(-1, count, size);
+        return false;
+    }
+    if (!hash.isEmpty() && hash != digest) {
+        qCDebug(logger) << "writeTo() got mismatched hash.";
+        return false;
+    }
+    hash = digest;
+    acknowledge();
+    return true;
+}
+
+// the new file is built next to the old one, and replaces it at last.
+bool RpcFilePrivate::writeToPathAsDelta(const QString &path, RpcFile::ProgressCallback progressCallback)
+{
+    Q_Q(RpcFile);
+    QSharedPointer<QFile> basis(new QFile(path));
+    if (!basis->open(QIODevice::ReadOnly)) {
+        basis.clear();
+    }
+    const QString &tempPath = path + QString::fromLatin1(".lafrpc-delta");
+    QSharedPointer<QFile> f(new QFile(tempPath));
+    if (!f->open(QIODevice::WriteOnly | QIODevice::Unbuffered)) {
+        if (progressCallback)
+            progressCallback(-1, 0, size);
+        return false;
+    }
+    if (!q->ready.tryWait()) {
+        f->remove();
+        return false;
+    }
+    bool success = recvfileAsDelta(FileLike::rawFile(f), progressCallback, basis.data());
+    f->close();
+    if (!basis.isNull()) {
+        basis->close();
+    }
+    if (!success) {
+        QFile::remove(tempPath);
+        return false;
+    }
+    // the new file takes the place and permissions of the old one. it is never missing in between.
+    if (!basis.isNull()) {
+        QFile::setPermissions(tempPath, QFile::permissions(path));
+    }
+#ifdef Q_OS_UNIX
+    if (::rename(QFile::encodeName(tempPath).constData(), QFile::encodeName(path).constData()) != 0) {
+#else
+    QFile::remove(path);
+    if (!QFile::rename(tempPath, path)) {
+#endif
+        qCWarning(logger) << "can not replace file:" << path;
+        QFile::remove(tempPath);
+        return false;
+    }
+    return true;
+}
+
+bool RpcFilePrivate::writeTo(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback, QFile *file,
+                             bool resume)
+{
+    Q_Q(RpcFile);
+    if (!q->ready.tryWait()) {
+        return false;
+    }
+    if (delta) {
+        return recvfileAsDelta(f, progressCallback, nullptr);
+    }
+    // the file is opened without truncating for resume. it is cut at the offset agreed with the sender, or at 0 if
+    // there is nothing to resume from.
+    const bool negotiating = resumable && size > 0 && !chunked;
+    if (!negotiating && file && file->size() > 0 && !file->resize(0)) {
+        qCWarning(logger) << "can not truncate file:" << file->fileName();
+        if (progressCallback)
+            progressCallback(-1, 0, size);
+        return false;
+    }
+    if (chunked) {
+        return recvfileChunked(f, progressCallback);
+    }
+    if (negotiating && !negotiateAsReceiver(file, resume)) {
+        qCDebug(logger) << "can not negotiate the offset of rpc file.";
+        if (progressCallback)
+            progressCallback(-1, 0, size);
+        return false;
+    }
+    if (preallocate && file) {
+        ZeroCopy::preallocate(file->handle(), static_cast<qint64>(offset), static_cast<qint64>(size));
+    }
+    if (!q->rawSocket.isNull()) {
+        return recvfileViaRawSocket(f, progressCallback, file);
+    } else if (effectiveStreams() > 1) {
+        // the blocks are written at their offsets. the file is not resized to the full size, or an interrupted
+        // transfer would look complete to the next resume.
+        return recvfileViaChannels(f, progressCallback, file);
+    } else {
+        return recvfileViaChannel(f, progressCallback);
+    }
+}
+
+bool RpcFilePrivate::readFrom(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback, QFile *file)
+{
+    Q_Q(RpcFile);
+    if (!q->ready.tryWait()) {
+        return false;
+    }
+    if (delta) {
+        return sendfileAsDelta(f, progressCallback);
+    } else if (chunked) {
+        return sendfileChunked(f, progressCallback);
+    }
+    if (resumable && size > 0 && !negotiateAsSender(f, file)) {
+        qCDebug(logger) << "can not negotiate the offset of rpc file.";
+        if (progressCallback)
+            progressCallback(-1, 0, size);
+        return false;
+    }
+    if (!q->rawSocket.isNull()) {
+        return sendfileViaRawSocket(f, progressCallback, file);
+    } else if (effectiveStreams() > 1) {
+        return sendfileViaChannels(f, progressCallback);
+    } else {
+        return sendfileViaChannel(f, progressCallback);
+    }
+}
+
+RpcFile::RpcFile(const QString &filePath, bool withHash, bool hashWhileSending)
     : d_ptr(new RpcFilePrivate(this))
 {
     Q_D(RpcFile);
@@ -298,7 +1396,9 @@ RpcFile::RpcFile(const QString &filePath, bool withHash)
 #endif
         d->mtime = static_cast<quint64>(fileInfo.lastModified().toMSecsSinceEpoch());
         d->atime = static_cast<quint64>(fileInfo.lastRead().toMSecsSinceEpoch());
-        if (withHash) {
+        if (withHash && hashWhileSending) {
+            d->hashWhileSending = true;
+        } else if (withHash) {
             calculateHash();
         }
     }
@@ -360,17 +1460,22 @@ bool RpcFile::isValid() const
     return !d->name.isEmpty();
 }
 
-bool RpcFile::writeToPath(const QString &path, RpcFile::ProgressCallback progressCallback)
+bool RpcFile::writeToPath(const QString &path, RpcFile::ProgressCallback progressCallback, bool resume)
 {
     Q_D(RpcFile);
+    if (d->delta) {
+        return d->writeToPathAsDelta(path, progressCallback);
+    }
     QSharedPointer<QFile> f(new QFile(path));
-    if (!f->open(QIODevice::WriteOnly | QIODevice::Unbuffered)) {
+    // the resumed file keeps its content.
+    const QIODevice::OpenMode mode = resume ? QIODevice::ReadWrite : QIODevice::WriteOnly;
+    if (!f->open(mode | QIODevice::Unbuffered)) {
         if (progressCallback) {
             progressCallback(-1, 0, d->size);
         }
         return false;
     }
-    return writeTo(FileLike::rawFile(f), progressCallback);
+    return d->writeTo(FileLike::rawFile(f), progressCallback, f.data(), resume);
 }
 
 bool RpcFile::readFromPath(const QString &path, RpcFile::ProgressCallback progressCallback)
@@ -383,7 +1488,15 @@ bool RpcFile::readFromPath(const QString &path, RpcFile::ProgressCallback progre
         }
         return false;
     }
-    return readFrom(FileLike::rawFile(f), progressCallback);
+    // the mapping avoids copying the content to user space, the files can not be mapped are read as usual.
+    QSharedPointer<FileLike> source;
+    if (d->memoryMapped) {
+        source = MappedFile::map(f);
+    }
+    if (source.isNull()) {
+        source = FileLike::rawFile(f);
+    }
+    return d->readFrom(source, progressCallback, f.data());
 }
 
 bool RpcFile::readFromPath(ProgressCallback progressCallback)
@@ -401,53 +1514,25 @@ bool RpcFile::readFromPath(ProgressCallback progressCallback)
 bool RpcFile::writeTo(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback)
 {
     Q_D(RpcFile);
-    if (!ready.tryWait()) {
-        return false;
-    }
-    if (rawSocket.isNull()) {
-        return d->recvfileViaChannel(f, progressCallback, QByteArray());
-    } else {
-        return d->recvfileViaRawSocket(f, progressCallback, QByteArray());
-    }
+    return d->writeTo(f, progressCallback, nullptr, false);
 }
 
 bool RpcFile::readFrom(QSharedPointer<FileLike> f, RpcFile::ProgressCallback progressCallback)
 {
     Q_D(RpcFile);
-    if (!ready.tryWait()) {
-        return false;
-    }
-    if (rawSocket.isNull()) {
-        return d->sendfileViaChannel(f, progressCallback);
-    } else {
-        return d->sendfileViaRawSocket(f, progressCallback);
-    }
+    return d->readFrom(f, progressCallback, nullptr);
 }
 
 bool RpcFile::sendall(const QByteArray &data, ProgressCallback progressCallback)
 {
     Q_D(RpcFile);
-    if (!ready.tryWait()) {
-        return false;
-    }
-    if (rawSocket.isNull()) {
-        return d->sendfileViaChannel(FileLike::bytes(data), progressCallback);
-    } else {
-        return d->sendfileViaRawSocket(FileLike::bytes(data), progressCallback);
-    }
+    return d->readFrom(FileLike::bytes(data), progressCallback, nullptr);
 }
 
 bool RpcFile::recvall(QByteArray &data, ProgressCallback progressCallback)
 {
     Q_D(RpcFile);
-    if (!ready.tryWait()) {
-        return false;
-    }
-    if (rawSocket.isNull()) {
-        return d->recvfileViaChannel(FileLike::bytes(&data), progressCallback, QByteArray());
-    } else {
-        return d->recvfileViaRawSocket(FileLike::bytes(&data), progressCallback, QByteArray());
-    }
+    return d->writeTo(FileLike::bytes(&data), progressCallback, nullptr, false);
 }
 
 QVariantMap RpcFile::saveState()
@@ -462,6 +1547,21 @@ QVariantMap RpcFile::saveState()
     if (!d->hash.isEmpty()) {
         state.insert("hash", d->hash);
     }
+    if (d->hashWhileSending) {
+        state.insert("trailer_hash", true);
+    }
+    if (d->effectiveStreams() > 1) {
+        state.insert("streams", d->effectiveStreams());
+    }
+    if (d->resumable) {
+        state.insert("resumable", true);
+    }
+    if (d->delta) {
+        state.insert("delta", true);
+    }
+    if (d->chunked) {
+        state.insert("chunked", true);
+    }
     return state;
 }
 
@@ -485,6 +1585,11 @@ bool RpcFile::restoreState(const QVariantMap &state)
     d->mtime = state.value("mtime").toULongLong(&ok);
     CHECKOK(ok, "RpcFile.mtime");
     d->hash = state.value("hash").toByteArray();
+    d->hashWhileSending = state.value("trailer_hash").toBool();
+    d->streams = qMax(state.value("streams").toInt(), 1);
+    d->resumable = state.value("resumable").toBool();
+    d->delta = state.value("delta").toBool();
+    d->chunked = state.value("chunked").toBool();
     return true;
 }
 
@@ -560,4 +1665,100 @@ void RpcFile::setHash(const QByteArray &hash)
     d->hash = hash;
 }
 
+bool RpcFile::hashWhileSending() const
+{
+    Q_D(const RpcFile);
+    return d->hashWhileSending;
+}
+
+void RpcFile::setHashWhileSending(bool hashWhileSending)
+{
+    Q_D(RpcFile);
+    d->hashWhileSending = hashWhileSending;
+}
+
+int RpcFile::parallelStreams() const
+{
+    Q_D(const RpcFile);
+    return d->streams;
+}
+
+void RpcFile::setParallelStreams(int streams)
+{
+    Q_D(RpcFile);
+    d->streams = qMax(streams, 1);
+}
+
+bool RpcFile::resumable() const
+{
+    Q_D(const RpcFile);
+    return d->resumable;
+}
+
+void RpcFile::setResumable(bool resumable)
+{
+    Q_D(RpcFile);
+    d->resumable = resumable;
+}
+
+bool RpcFile::delta() const
+{
+    Q_D(const RpcFile);
+    return d->delta;
+}
+
+void RpcFile::setDelta(bool delta)
+{
+    Q_D(RpcFile);
+    d->delta = delta;
+}
+
+bool RpcFile::chunked() const
+{
+    Q_D(const RpcFile);
+    return d->chunked;
+}
+
+void RpcFile::setChunked(bool chunked)
+{
+    Q_D(RpcFile);
+    d->chunked = chunked;
+}
+
+QSharedPointer<RpcChunkStore> RpcFile::chunkStore() const
+{
+    Q_D(const RpcFile);
+    return d->chunkStore;
+}
+
+void RpcFile::setChunkStore(QSharedPointer<RpcChunkStore> chunkStore)
+{
+    Q_D(RpcFile);
+    d->chunkStore = chunkStore;
+}
+
+bool RpcFile::preallocate() const
+{
+    Q_D(const RpcFile);
+    return d->preallocate;
+}
+
+void RpcFile::setPreallocate(bool preallocate)
+{
+    Q_D(RpcFile);
+    d->preallocate = preallocate;
+}
+
+bool RpcFile::memoryMapped() const
+{
+    Q_D(const RpcFile);
+    return d->memoryMapped;
+}
+
+void RpcFile::setMemoryMapped(bool memoryMapped)
+{
+    Q_D(RpcFile);
+    d->memoryMapped = memoryMapped;
+}
+
 END_LAFRPC_NAMESPACE
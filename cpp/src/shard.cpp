@@ -0,0 +1,107 @@
+#include "../include/rpc_p.h"
+#include <QtCore/qloggingcategory.h>
+#ifdef Q_OS_UNIX
+#  include <sys/socket.h>
+#  include <unistd.h>
+#endif
+
+static Q_LOGGING_CATEGORY(logger, "lafrpc.shard");
+
+BEGIN_LAFRPC_NAMESPACE
+
+RpcShard::RpcShard(QSharedPointer<Rpc> rpc, int index)
+    : index(index)
+    , rpc(rpc)
+    , stopping(false)
+{
+    fds[0] = fds[1] = -1;
+#ifdef Q_OS_UNIX
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        qCWarning(logger) << "can not create notifier for shard" << index;
+        fds[0] = fds[1] = -1;
+    }
+#else
+    qCWarning(logger) << "the shard mode is not supported in this platform.";
+#endif
+}
+
+RpcShard::~RpcShard()
+{
+#ifdef Q_OS_UNIX
+    // fds[0] is owned by the notifier socket of run().
+    if (fds[1] >= 0) {
+        ::close(fds[1]);
+    }
+    if (!isFinished() && fds[0] >= 0) {
+        ::close(fds[0]);
+    }
+#endif
+}
+
+bool RpcShard::post(const std::function<void(Rpc *)> &task)
+{
+    {
+        QMutexLocker locker(&mutex);
+        if (stopping || fds[1] < 0) {
+            return false;
+        }
+        tasks.append(task);
+    }
+    wakeup();
+    return true;
+}
+
+void RpcShard::stop()
+{
+    {
+        QMutexLocker locker(&mutex);
+        stopping = true;
+    }
+    wakeup();
+}
+
+void RpcShard::wakeup()
+{
+#ifdef Q_OS_UNIX
+    if (fds[1] >= 0) {
+        // if the buffer is full, the shard is going to wake up already.
+        ::send(fds[1], "\x01", 1, MSG_DONTWAIT);
+    }
+#endif
+}
+
+void RpcShard::run()
+{
+    if (fds[0] < 0) {
+        rpc.clear();
+        return;
+    }
+    QSharedPointer<qtng::Socket> notifier(new qtng::Socket(fds[0]));
+    qtng::CoroutineGroup *operations = RpcPrivate::getPrivateHelper(rpc.data())->operations;
+    while (true) {
+        QList<std::function<void(Rpc *)>> pendingTasks;
+        bool done;
+        {
+            QMutexLocker locker(&mutex);
+            pendingTasks.swap(tasks);
+            done = stopping;
+        }
+        if (done) {
+            break;
+        }
+        for (const std::function<void(Rpc *)> &task : pendingTasks) {
+            QSharedPointer<Rpc> rpc = this->rpc;
+            operations->spawn([rpc, task] { task(rpc.data()); });
+        }
+        if (notifier->recv(1024).isEmpty()) {
+            qCWarning(logger) << "the notifier of shard" << index << "is broken.";
+            break;
+        }
+    }
+    rpc->shutdown();
+    // delete rpc and its peers in this thread.
+    rpc.clear();
+    notifier->close();
+}
+
+END_LAFRPC_NAMESPACE
@@ -0,0 +1,438 @@
+#include <QtCore/qloggingcategory.h>
+#include <QtCore/qendian.h>
+#include <atomic>
+#include "../include/shm_p.h"
+#ifdef Q_OS_UNIX
+#  include <fcntl.h>
+#  include <string.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+static Q_LOGGING_CATEGORY(logger, "lafrpc.shm");
+
+using namespace qtng;
+
+BEGIN_LAFRPC_NAMESPACE
+
+const quint32 RingCapacity = 1024 * 1024 * 4;
+const quint32 RingHeaderSize = 256;
+
+// head and tail grow forever, the position in data is `head % capacity`.
+struct ShmRing
+{
+    alignas(64) std::atomic<quint64> head;
+    alignas(64) std::atomic<quint64> tail;
+    alignas(64) std::atomic<quint32> readerWaiting;
+    std::atomic<quint32> writerWaiting;
+};
+
+static_assert(sizeof(ShmRing) <= RingHeaderSize, "the header of ring is too large.");
+
+static inline size_t segmentSize(quint32 capacity)
+{
+    return (static_cast<size_t>(RingHeaderSize) + capacity) * 2;
+}
+
+ShmSocket::ShmSocket(QSharedPointer<SocketLike> bootstrap, char *mapped, quint32 capacity, bool asServer)
+    : bootstrap(bootstrap)
+    , mapped(mapped)
+    , capacity(capacity)
+    , operations(new CoroutineGroup())
+    , broken(false)
+{
+    // the first ring is written by client, the second one is written by server.
+    ShmRing *first = reinterpret_cast<ShmRing *>(mapped);
+    ShmRing *second = reinterpret_cast<ShmRing *>(mapped + RingHeaderSize + capacity);
+    tx = asServer ? second : first;
+    rx = asServer ? first : second;
+    txData = reinterpret_cast<char *>(tx) + RingHeaderSize;
+    rxData = reinterpret_cast<char *>(rx) + RingHeaderSize;
+    operations->spawn([this] { watch(); });
+}
+
+ShmSocket::~ShmSocket()
+{
+    delete operations;
+    bootstrap->close();
+#ifdef Q_OS_UNIX
+    ::munmap(mapped, segmentSize(capacity));
+#endif
+}
+
+QSharedPointer<ShmSocket> ShmSocket::handshake(QSharedPointer<SocketLike> bootstrap, bool asServer)
+{
+#ifdef Q_OS_UNIX
+    QByteArray name;
+    quint32 capacity;
+    int fd;
+    if (asServer) {
+        const QByteArray &header = bootstrap->recvall(1);
+        if (header.size() != 1) {
+            return QSharedPointer<ShmSocket>();
+        }
+        name = bootstrap->recvall(static_cast<quint8>(header.at(0)));
+        const QByteArray &capacityBytes = bootstrap->recvall(4);
+        if (name.isEmpty() || name.size() != static_cast<quint8>(header.at(0)) || capacityBytes.size() != 4) {
+            return QSharedPointer<ShmSocket>();
+        }
+        capacity = qFromBigEndian<quint32>(capacityBytes.constData());
+        if (capacity == 0 || capacity > RingCapacity * 16) {
+            qCWarning(logger) << "the shared memory ring is too large:" << capacity;
+            bootstrap->sendall("\x00", 1);
+            return QSharedPointer<ShmSocket>();
+        }
+        fd = ::shm_open(name.constData(), O_RDWR, 0600);
+        struct stat st;
+        if (fd < 0 || ::fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < segmentSize(capacity)) {
+            qCWarning(logger) << "can not open shared memory:" << name << strerror(errno);
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            bootstrap->sendall("\x00", 1);
+            return QSharedPointer<ShmSocket>();
+        }
+    } else {
+        capacity = RingCapacity;
+        name = "/lafrpc-" + randomBytes(8).toHex();
+        fd = ::shm_open(name.constData(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0) {
+            qCWarning(logger) << "can not create shared memory:" << name << strerror(errno);
+            return QSharedPointer<ShmSocket>();
+        }
+        if (::ftruncate(fd, static_cast<off_t>(segmentSize(capacity))) < 0) {
+            qCWarning(logger) << "can not allocate shared memory:" << name << strerror(errno);
+            ::close(fd);
+            ::shm_unlink(name.constData());
+            return QSharedPointer<ShmSocket>();
+        }
+    }
+    void *p = ::mmap(nullptr, segmentSize(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        qCWarning(logger) << "can not map shared memory:" << name << strerror(errno);
+        if (!asServer) {
+            ::shm_unlink(name.constData());
+        } else {
+            bootstrap->sendall("\x00", 1);
+        }
+        return QSharedPointer<ShmSocket>();
+    }
+    char *mapped = static_cast<char *>(p);
+    if (asServer) {
+        if (bootstrap->sendall("\x01", 1) != 1) {
+            ::munmap(mapped, segmentSize(capacity));
+            return QSharedPointer<ShmSocket>();
+        }
+    } else {
+        new (mapped) ShmRing();
+        new (mapped + RingHeaderSize + capacity) ShmRing();
+        QByteArray header;
+        header.append(static_cast<char>(name.size()));
+        header.append(name);
+        char capacityBytes[4];
+        qToBigEndian<quint32>(capacity, capacityBytes);
+        header.append(capacityBytes, 4);
+        bool ok = bootstrap->sendall(header) == header.size() && bootstrap->recvall(1) == QByteArray("\x01", 1);
+        // the name is not needed any more after both sides mapped the segment.
+        ::shm_unlink(name.constData());
+        if (!ok) {
+            qCDebug(logger) << "the other side refuses shared memory:" << name;
+            ::munmap(mapped, segmentSize(capacity));
+            return QSharedPointer<ShmSocket>();
+        }
+    }
+    return QSharedPointer<ShmSocket>(new ShmSocket(bootstrap, mapped, capacity, asServer));
+#else
+    Q_UNUSED(bootstrap);
+    Q_UNUSED(asServer);
+    return QSharedPointer<ShmSocket>();
+#endif
+}
+
+// the doorbell bytes are meaningless, every byte tells something was changed in rings.
+void ShmSocket::watch()
+{
+    while (true) {
+        const QByteArray &buf = bootstrap->recv(64);
+        if (buf.isEmpty()) {
+            broken = true;
+            changed.set();
+            return;
+        }
+        changed.set();
+    }
+}
+
+void ShmSocket::ring()
+{
+    if (broken || !doorbellLock.acquire()) {
+        return;
+    }
+    if (bootstrap->sendall("\x01", 1) != 1) {
+        broken = true;
+        changed.set();
+    }
+    doorbellLock.release();
+}
+
+qint32 ShmSocket::read(char *data, qint32 size, bool consume)
+{
+    if (size <= 0) {
+        return 0;
+    }
+    while (true) {
+        quint64 head = rx->head.load(std::memory_order_acquire);
+        quint64 tail = rx->tail.load(std::memory_order_relaxed);
+        if (head != tail) {
+            quint32 n = static_cast<quint32>(qMin<quint64>(head - tail, static_cast<quint64>(size)));
+            quint32 offset = static_cast<quint32>(tail % capacity);
+            quint32 first = qMin(n, capacity - offset);
+            memcpy(data, rxData + offset, first);
+            if (n > first) {
+                memcpy(data + first, rxData, n - first);
+            }
+            if (consume) {
+                rx->tail.store(tail + n, std::memory_order_seq_cst);
+                if (rx->writerWaiting.load(std::memory_order_seq_cst)) {
+                    ring();
+                }
+            }
+            return static_cast<qint32>(n);
+        }
+        if (broken) {
+            return 0;
+        }
+        // set the flag before checking again, so the writer can not miss us.
+        changed.clear();
+        rx->readerWaiting.store(1, std::memory_order_seq_cst);
+        if (rx->head.load(std::memory_order_seq_cst) == tail) {
+            changed.tryWait();
+        }
+        rx->readerWaiting.store(0, std::memory_order_relaxed);
+    }
+}
+
+qint32 ShmSocket::send(const char *data, qint32 size)
+{
+    if (size <= 0) {
+        return 0;
+    }
+    while (true) {
+        if (broken) {
+            return -1;
+        }
+        quint64 head = tx->head.load(std::memory_order_relaxed);
+        quint64 tail = tx->tail.load(std::memory_order_acquire);
+        quint64 space = capacity - (head - tail);
+        if (space > 0) {
+            quint32 n = static_cast<quint32>(qMin<quint64>(space, static_cast<quint64>(size)));
+            quint32 offset = static_cast<quint32>(head % capacity);
+            quint32 first = qMin(n, capacity - offset);
+            memcpy(txData + offset, data, first);
+            if (n > first) {
+                memcpy(txData, data + first, n - first);
+            }
+            tx->head.store(head + n, std::memory_order_seq_cst);
+            if (tx->readerWaiting.load(std::memory_order_seq_cst)) {
+                ring();
+            }
+            return static_cast<qint32>(n);
+        }
+        changed.clear();
+        tx->writerWaiting.store(1, std::memory_order_seq_cst);
+        if (tx->tail.load(std::memory_order_seq_cst) == tail) {
+            changed.tryWait();
+        }
+        tx->writerWaiting.store(0, std::memory_order_relaxed);
+    }
+}
+
+qint32 ShmSocket::peek(char *data, qint32 size)
+{
+    return read(data, size, false);
+}
+
+qint32 ShmSocket::peekRaw(char *data, qint32 size)
+{
+    return read(data, size, false);
+}
+
+qint32 ShmSocket::recv(char *data, qint32 size)
+{
+    return read(data, size, true);
+}
+
+qint32 ShmSocket::recvall(char *data, qint32 size)
+{
+    qint32 total = 0;
+    while (total < size) {
+        qint32 n = read(data + total, size - total, true);
+        if (n <= 0) {
+            break;
+        }
+        total += n;
+    }
+    return total;
+}
+
+qint32 ShmSocket::sendall(const char *data, qint32 size)
+{
+    qint32 total = 0;
+    while (total < size) {
+        qint32 n = send(data + total, size - total);
+        if (n <= 0) {
+            break;
+        }
+        total += n;
+    }
+    return total;
+}
+
+QByteArray ShmSocket::recv(qint32 size)
+{
+    QByteArray buf(size, Qt::Uninitialized);
+    qint32 n = read(buf.data(), size, true);
+    buf.resize(qMax(n, 0));
+    return buf;
+}
+
+QByteArray ShmSocket::recvall(qint32 size)
+{
+    QByteArray buf(size, Qt::Uninitialized);
+    qint32 n = recvall(buf.data(), size);
+    buf.resize(qMax(n, 0));
+    return buf;
+}
+
+qint32 ShmSocket::send(const QByteArray &data)
+{
+    return send(data.constData(), data.size());
+}
+
+qint32 ShmSocket::sendall(const QByteArray &data)
+{
+    return sendall(data.constData(), data.size());
+}
+
+Socket::SocketError ShmSocket::error() const
+{
+    return broken ? Socket::RemoteHostClosedError : Socket::NoError;
+}
+
+QString ShmSocket::errorString() const
+{
+    return broken ? QString::fromLatin1("the shared memory peer is closed.") : QString();
+}
+
+bool ShmSocket::isValid() const
+{
+    return !broken;
+}
+
+HostAddress ShmSocket::localAddress() const
+{
+    return HostAddress();
+}
+
+quint16 ShmSocket::localPort() const
+{
+    return 0;
+}
+
+HostAddress ShmSocket::peerAddress() const
+{
+    return HostAddress();
+}
+
+QString ShmSocket::peerName() const
+{
+    return QString();
+}
+
+quint16 ShmSocket::peerPort() const
+{
+    return 0;
+}
+
+// there is no file descriptor carrying the data, so nobody can bypass the rings.
+qintptr ShmSocket::fileno() const
+{
+    return -1;
+}
+
+Socket::SocketType ShmSocket::type() const
+{
+    return Socket::TcpSocket;
+}
+
+Socket::SocketState ShmSocket::state() const
+{
+    return broken ? Socket::UnconnectedState : Socket::ConnectedState;
+}
+
+HostAddress::NetworkLayerProtocol ShmSocket::protocol() const
+{
+    return HostAddress::UnknownNetworkLayerProtocol;
+}
+
+Socket *ShmSocket::acceptRaw()
+{
+    return nullptr;
+}
+
+QSharedPointer<SocketLike> ShmSocket::accept()
+{
+    return QSharedPointer<SocketLike>();
+}
+
+bool ShmSocket::bind(const HostAddress &, quint16, Socket::BindMode)
+{
+    return false;
+}
+
+bool ShmSocket::bind(quint16, Socket::BindMode)
+{
+    return false;
+}
+
+bool ShmSocket::connect(const HostAddress &, quint16)
+{
+    return false;
+}
+
+bool ShmSocket::connect(const QString &, quint16, QSharedPointer<SocketDnsCache>)
+{
+    return false;
+}
+
+void ShmSocket::close()
+{
+    // the other side drains the ring and then sees the end of bootstrap socket.
+    broken = true;
+    bootstrap->close();
+    changed.set();
+}
+
+void ShmSocket::abort()
+{
+    close();
+}
+
+bool ShmSocket::listen(int)
+{
+    return false;
+}
+
+bool ShmSocket::setOption(Socket::SocketOption, const QVariant &)
+{
+    return false;
+}
+
+QVariant ShmSocket::option(Socket::SocketOption) const
+{
+    return QVariant();
+}
+
+END_LAFRPC_NAMESPACE
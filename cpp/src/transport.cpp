@@ -1,10 +1,26 @@
+#include <QtCore/qatomic.h>
 #include <QtCore/qdatetime.h>
+#include <QtCore/qdir.h>
+#include <QtCore/qfile.h>
+#include <QtCore/qthread.h>
 #include <QtCore/qurl.h>
 #include <QtCore/qloggingcategory.h>
 #include "../include/transport.h"
 #include "../include/rpc.h"
 #include "../include/rpc_p.h"
 #include "../include/peer.h"
+#include "../include/shm_p.h"
+#include "../include/coalescing_p.h"
+#include "../include/wrapped_socket_p.h"
+#ifdef Q_OS_UNIX
+#  include <errno.h>
+#  include <fcntl.h>
+#  include <string.h>
+#  include <sys/socket.h>
+#  include <sys/stat.h>
+#  include <sys/un.h>
+#  include <unistd.h>
+#endif
 
 static Q_LOGGING_CATEGORY(logger, "lafrpc.transport");
 
@@ -36,6 +52,21 @@ bool Transport::parseAddress(const QString &address, QString &host, quint16 &por
     return port > 0;
 }
 
+bool Transport::canReusePort() const
+{
+    return false;
+}
+
+bool Transport::canDispatch() const
+{
+    return true;
+}
+
+bool Transport::isPlain() const
+{
+    return false;
+}
+
 bool Transport::startServer(const QString &address)
 {
     QSharedPointer<BaseStreamServer> server = createServer(address);
@@ -46,6 +77,18 @@ bool Transport::startServer(const QString &address)
     return server->serveForever();
 }
 
+static QSharedPointer<SocketLike> coalesce(QPointer<Rpc> rpc, QSharedPointer<SocketLike> request)
+{
+    const RpcPrivate *d = RpcPrivate::getPrivateHelper(rpc.data());
+    if (d->readBufferSize > 0) {
+        request.reset(new BufferedReadSocket(request, d->readBufferSize));
+    }
+    if (d->coalescingBytes == 0) {
+        return request;
+    }
+    return QSharedPointer<SocketLike>(new CoalescingSocket(request, d->coalescingBytes, d->coalescingDelay));
+}
+
 QSharedPointer<DataChannel> Transport::connect(const QString &address)
 {
     QString host;
@@ -68,7 +111,7 @@ QSharedPointer<DataChannel> Transport::connect(const QString &address)
         qCDebug(logger) << "handshaking is failed in client side.";
         return QSharedPointer<DataChannel>();
     }
-    QSharedPointer<SocketChannel> channel(new SocketChannel(request, PositivePole));
+    QSharedPointer<SocketChannel> channel(new SocketChannel(coalesce(rpc, request), PositivePole));
     setupChannel(request, channel);
     return channel;
 }
@@ -88,7 +131,14 @@ QSharedPointer<SocketLike> Transport::makeRawSocket(const QString &address, QByt
     if (request.isNull()) {
         return request;
     }
+    if (!handshakeRawSocket(request, connectionId)) {
+        return QSharedPointer<SocketLike>();
+    }
+    return isPlain() ? PlainSocket::wrap(request) : request;
+}
 
+bool Transport::handshakeRawSocket(QSharedPointer<SocketLike> request, QByteArray &connectionId)
+{
     connectionId = randomBytes(16);
     QByteArray packet = connectionId;
     packet.prepend("\x33\x74");
@@ -96,21 +146,115 @@ QSharedPointer<SocketLike> Transport::makeRawSocket(const QString &address, QByt
     if (sentBytes != packet.size()) {
         connectionId.clear();
         qCDebug(logger) << "handshaking is failed in client side.";
-        return QSharedPointer<SocketLike>();
+        return false;
     }
     if (request->recvall(2) != "\xf3\x97") {
         connectionId.clear();
-        return QSharedPointer<SocketLike>();
-    } else {
-        qCDebug(logger) << "raw socket handshake finished.";
+        return false;
     }
-    return request;
+    qCDebug(logger) << "raw socket handshake finished.";
+    return true;
 }
 
 QSharedPointer<SocketLike> Transport::takeRawSocket(const QByteArray &connectionId)
 {
-    const RawSocket &rawConnection = rawConnections[connectionId];
-    return rawConnection.connection;
+    QMutexLocker locker(&rawConnectionsLock);
+    return rawConnections.take(connectionId).connection;
+}
+
+static void findOldest(QMap<QByteArray, RawSocket> &rawSockets, QMap<QByteArray, RawSocket> **found,
+                       QMap<QByteArray, RawSocket>::iterator *oldest)
+{
+    for (QMap<QByteArray, RawSocket>::iterator itor = rawSockets.begin(); itor != rawSockets.end(); ++itor) {
+        if (!*found || itor.value().timeStamp < (*oldest).value().timeStamp) {
+            *found = &rawSockets;
+            *oldest = itor;
+        }
+    }
+}
+
+// the idle raw sockets count against maxRawSockets too. call it with rawConnectionsLock held.
+QSharedPointer<SocketLike> Transport::dropOldestRawSocket()
+{
+    int maxRawSockets = rpc.isNull() ? 0 : RpcPrivate::getPrivateHelper(rpc.data())->maxRawSockets;
+    if (maxRawSockets <= 0 || rawConnections.size() + idleRawConnections.size() < maxRawSockets) {
+        return QSharedPointer<SocketLike>();
+    }
+    QMap<QByteArray, RawSocket> *found = nullptr;
+    QMap<QByteArray, RawSocket>::iterator oldest;
+    findOldest(rawConnections, &found, &oldest);
+    findOldest(idleRawConnections, &found, &oldest);
+    if (!found) {
+        return QSharedPointer<SocketLike>();
+    }
+    QSharedPointer<SocketLike> dropped = oldest.value().connection;
+    found->erase(oldest);
+    return dropped;
+}
+
+// the oldest one is dropped if there are too many raw sockets.
+void Transport::addRawSocket(const QByteArray &connectionId, QSharedPointer<SocketLike> request)
+{
+    QSharedPointer<SocketLike> dropped;
+    {
+        QMutexLocker locker(&rawConnectionsLock);
+        dropped = dropOldestRawSocket();
+        rawConnections.insert(connectionId, RawSocket(request, QDateTime::currentDateTime()));
+    }
+    if (!dropped.isNull()) {
+        qCDebug(logger) << "too many raw sockets, drop the oldest one.";
+        dropped->close();
+    }
+}
+
+void Transport::recycleRawSocket(QSharedPointer<SocketLike> request)
+{
+    const QByteArray &key = randomBytes(16);
+    QSharedPointer<SocketLike> dropped;
+    {
+        QMutexLocker locker(&rawConnectionsLock);
+        dropped = dropOldestRawSocket();
+        idleRawConnections.insert(key, RawSocket(request, QDateTime::currentDateTime()));
+    }
+    if (!dropped.isNull()) {
+        qCDebug(logger) << "too many raw sockets, drop the oldest one.";
+        dropped->close();
+    }
+    const QByteArray &rpcHeader = request->recvall(2);
+    {
+        QMutexLocker locker(&rawConnectionsLock);
+        if (idleRawConnections.take(key).connection.isNull()) {
+            // reaped or dropped while waiting, and closed already.
+            return;
+        }
+    }
+    if (!handleHeader(request, rpcHeader)) {
+        request->close();
+    }
+}
+
+int Transport::reapRawSockets(qint64 timeout)
+{
+    const QDateTime &expired = QDateTime::currentDateTime().addMSecs(-timeout);
+    QList<QSharedPointer<SocketLike>> dropped;
+    {
+        QMutexLocker locker(&rawConnectionsLock);
+        for (QMap<QByteArray, RawSocket> *rawSockets : { &rawConnections, &idleRawConnections }) {
+            QMap<QByteArray, RawSocket>::iterator itor = rawSockets->begin();
+            while (itor != rawSockets->end()) {
+                if (itor.value().timeStamp < expired) {
+                    dropped.append(itor.value().connection);
+                    itor = rawSockets->erase(itor);
+                } else {
+                    ++itor;
+                }
+            }
+        }
+    }
+    for (QSharedPointer<SocketLike> connection : dropped) {
+        connection->close();
+    }
+    return dropped.size();
 }
 
 void Transport::setupChannel(QSharedPointer<SocketLike> request, QSharedPointer<SocketChannel> channel)
@@ -154,7 +298,7 @@ QSharedPointer<BaseStreamServer> Transport::createServer(const QString &address)
 
     HostAddress host(hostStr);
     if (host.isNull()) {
-        const QList<HostAddress> &l = RpcPrivate::getPrivateHelper(rpc.data())->dnsCache->resolve(hostStr);
+        const QList<HostAddress> &l = RpcPrivate::getPrivateHelper(rpc.data())->resolver->resolve(hostStr);
         if (l.isEmpty()) {
             qCWarning(logger) << "require ip address to start server.";
             return QSharedPointer<BaseStreamServer>();
@@ -179,19 +323,20 @@ bool Transport::handleRequest(QSharedPointer<SocketLike> request, QByteArray &rp
 
     request->setOption(Socket::LowDelayOption, true);
     rpcHeader = request->recvall(2);
+    return handleHeader(request, rpcHeader);
+}
+
+bool Transport::handleHeader(QSharedPointer<SocketLike> request, const QByteArray &rpcHeader)
+{
+    if (rpc.isNull()) {
+        return false;
+    }
     if (rpcHeader == QByteArray("\x4e\x67")) {
-        QSharedPointer<SocketChannel> channel(new SocketChannel(request, NegativePole));
-        setupChannel(request, channel);
-        QString address = getAddressTemplate();
-        const HostAddress &peerAddress = request->peerAddress();
-        if (peerAddress.protocol() == HostAddress::IPv6Protocol) {
-            address = address.arg(QString::fromLatin1("[%1]").arg(peerAddress.toString()));
-        } else {
-            address = address.arg(peerAddress.toString());
-        }
-        address = address.arg(request->peerPort());
+        const QString &address = getPeerAddress(request);
         // qCDebug(logger) << "got request from:" << address;
-        rpc->preparePeer(channel, QString(), address);
+        if (!RpcPrivate::getPrivateHelper(rpc.data())->dispatchPeer(request, name(), address)) {
+            acceptPeer(request, address);
+        }
     } else if (rpcHeader == QByteArray("\x33\x74")) {
         const QByteArray &connectionId = request->recvall(16);
         if (request->sendall("\xf3\x97") != 2) {
@@ -199,13 +344,35 @@ bool Transport::handleRequest(QSharedPointer<SocketLike> request, QByteArray &rp
             return false;
         }
         qCDebug(logger) << "got raw socket:" << connectionId;
-        rawConnections.insert(connectionId, RawSocket(request, QDateTime::currentDateTime()));
+        addRawSocket(connectionId, isPlain() ? PlainSocket::wrap(request) : request);
     } else {
         return false;
     }
     return true;
 }
 
+QString Transport::getPeerAddress(QSharedPointer<SocketLike> request)
+{
+    QString address = getAddressTemplate();
+    const HostAddress &peerAddress = request->peerAddress();
+    if (peerAddress.protocol() == HostAddress::IPv6Protocol) {
+        address = address.arg(QString::fromLatin1("[%1]").arg(peerAddress.toString()));
+    } else {
+        address = address.arg(peerAddress.toString());
+    }
+    return address.arg(request->peerPort());
+}
+
+void Transport::acceptPeer(QSharedPointer<SocketLike> request, const QString &address)
+{
+    if (rpc.isNull()) {
+        return;
+    }
+    QSharedPointer<SocketChannel> channel(new SocketChannel(coalesce(rpc, request), NegativePole));
+    setupChannel(request, channel);
+    rpc->preparePeer(channel, QString(), address);
+}
+
 class TcpTransportRequestHandler : public BaseRequestHandler
 {
 protected:
@@ -217,10 +384,85 @@ protected:
     virtual void finish() override { }
 };
 
+static bool setReusePort(qintptr fd)
+{
+#if defined(Q_OS_UNIX) && defined(SO_REUSEPORT)
+    int flag = 1;
+    return ::setsockopt(static_cast<int>(fd), SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag)) == 0;
+#else
+    Q_UNUSED(fd);
+    return false;
+#endif
+}
+
+// every shard opens its own listening socket on the same address, the kernel balances the accepting.
+template<typename ServerType>
+class ReusePortServer : public ServerType
+{
+public:
+    ReusePortServer(const HostAddress &serverAddress, quint16 serverPort)
+        : ServerType(serverAddress, serverPort)
+    {
+    }
+protected:
+    virtual QSharedPointer<SocketLike> serverCreate() override;
+};
+
+template<typename ServerType>
+QSharedPointer<SocketLike> ReusePortServer<ServerType>::serverCreate()
+{
+    QSharedPointer<Socket> s(new Socket(this->serverAddress().protocol()));
+    s->setOption(Socket::AddressReusable, true);
+    if (!setReusePort(s->fileno())) {
+        qCWarning(logger) << "can not set SO_REUSEPORT for" << this->serverAddress().toString()
+                          << this->serverPort();
+    }
+    return asSocketLike(s);
+}
+
+// run the server side handshakes in the handshake thread pool of rpc.
+template<typename ServerType>
+class PooledSslServer : public WithSsl<ServerType>
+{
+public:
+    PooledSslServer(const HostAddress &serverAddress, quint16 serverPort, const SslConfiguration &configuration,
+                    QPointer<Rpc> rpc)
+        : WithSsl<ServerType>(serverAddress, serverPort, configuration)
+        , configuration(configuration)
+        , rpc(rpc)
+    {
+    }
+protected:
+    virtual QSharedPointer<SocketLike> prepareRequest(QSharedPointer<SocketLike> request) override;
+private:
+    SslConfiguration configuration;
+    QPointer<Rpc> rpc;
+};
+
+template<typename ServerType>
+QSharedPointer<SocketLike> PooledSslServer<ServerType>::prepareRequest(QSharedPointer<SocketLike> request)
+{
+    if (rpc.isNull()) {
+        return QSharedPointer<SocketLike>();
+    }
+    if (RpcPrivate::getPrivateHelper(rpc.data())->handshakeThreads <= 0) {
+        return WithSsl<ServerType>::prepareRequest(request);
+    }
+    QSharedPointer<SslSocket> ssl(new SslSocket(request, configuration));
+    if (!RpcPrivate::getPrivateHelper(rpc.data())->handshake(ssl, true)) {
+        return QSharedPointer<SocketLike>();
+    }
+    return asSocketLike(ssl);
+}
+
+typedef PooledSslServer<TcpServer<TcpTransportRequestHandler>> TcpSslServer;
+typedef ReusePortServer<TcpServer<TcpTransportRequestHandler>> ReusePortTcpServer;
+typedef PooledSslServer<ReusePortTcpServer> ReusePortSslServer;
+
 QSharedPointer<SocketLike> TcpTransport::createConnection(const QString &, const QString &host, quint16 port,
-                                                          QSharedPointer<SocketDnsCache> dnsCache)
+                                                          QSharedPointer<SocketDnsCache>)
 {
-    QSharedPointer<Socket> s(Socket::createConnection(host, port, nullptr, dnsCache));
+    QSharedPointer<Socket> s = RpcPrivate::getPrivateHelper(rpc.data())->resolver->connect(host, port);
     if (!s.isNull()) {
         return asSocketLike(s);
     } else {
@@ -230,7 +472,12 @@ QSharedPointer<SocketLike> TcpTransport::createConnection(const QString &, const
 
 QSharedPointer<BaseStreamServer> TcpTransport::createServer(const QString &, const HostAddress &host, quint16 port)
 {
-    QSharedPointer<BaseStreamServer> server(new TcpServer<TcpTransportRequestHandler>(host, port));
+    QSharedPointer<BaseStreamServer> server;
+    if (RpcPrivate::getPrivateHelper(rpc.data())->reusePort) {
+        server.reset(new ReusePortTcpServer(host, port));
+    } else {
+        server.reset(new TcpServer<TcpTransportRequestHandler>(host, port));
+    }
     server->setUserData(this);
     return server;
 }
@@ -250,20 +497,47 @@ bool TcpTransport::canHandle(const QString &address)
     return address.startsWith("tcp://", Qt::CaseInsensitive);
 }
 
+bool TcpTransport::canReusePort() const
+{
+    return true;
+}
+
+bool TcpTransport::isPlain() const
+{
+    return true;
+}
+
 QSharedPointer<SocketLike> SslTransport::createConnection(const QString &, const QString &host, quint16 port,
                                                           QSharedPointer<SocketDnsCache> dnsCache)
 {
-    QSharedPointer<SslSocket> ssl(SslSocket::createConnection(host, port, sslConfig, nullptr, dnsCache));
-    if (!ssl.isNull()) {
-        return asSocketLike(ssl);
-    } else {
+    RpcPrivate *d = RpcPrivate::getPrivateHelper(rpc.data());
+    if (d->handshakeThreads <= 0) {
+        QSharedPointer<SslSocket> ssl(SslSocket::createConnection(host, port, sslConfig, nullptr, dnsCache));
+        if (!ssl.isNull()) {
+            return asSocketLike(ssl);
+        } else {
+            return QSharedPointer<SocketLike>();
+        }
+    }
+    QSharedPointer<Socket> s = d->resolver->connect(host, port);
+    if (s.isNull()) {
+        return QSharedPointer<SocketLike>();
+    }
+    QSharedPointer<SslSocket> ssl(new SslSocket(asSocketLike(s), sslConfig));
+    if (!d->handshake(ssl, false)) {
         return QSharedPointer<SocketLike>();
     }
+    return asSocketLike(ssl);
 }
 
 QSharedPointer<BaseStreamServer> SslTransport::createServer(const QString &, const HostAddress &host, quint16 port)
 {
-    QSharedPointer<BaseStreamServer> server(new SslServer<TcpTransportRequestHandler>(host, port, sslConfig));
+    QSharedPointer<BaseStreamServer> server;
+    if (RpcPrivate::getPrivateHelper(rpc.data())->reusePort) {
+        server.reset(new ReusePortSslServer(host, port, sslConfig, rpc));
+    } else {
+        server.reset(new TcpSslServer(host, port, sslConfig, rpc));
+    }
     server->setUserData(this);
     return server;
 }
@@ -278,6 +552,11 @@ bool SslTransport::canHandle(const QString &address)
     return address.startsWith("ssl://", Qt::CaseInsensitive) || address.startsWith("ssl+tcp://", Qt::CaseInsensitive);
 }
 
+bool SslTransport::isPlain() const
+{
+    return false;
+}
+
 QString SslTransport::getAddressTemplate()
 {
     return QStringLiteral("ssl://%1:%2");
@@ -355,12 +634,22 @@ bool KcpTransport::canHandle(const QString &address)
     return address.startsWith("kcp://", Qt::CaseInsensitive);
 }
 
+bool KcpTransport::canReusePort() const
+{
+    return false;
+}
+
+bool KcpTransport::isPlain() const
+{
+    return false;
+}
+
 QString KcpTransport::getAddressTemplate()
 {
     return QStringLiteral("kcp://%1:%2");
 }
 
-typedef WithSsl<KcpServerWithFilter> SslKcpServerWithFilter;
+typedef PooledSslServer<KcpServerWithFilter> SslKcpServerWithFilter;
 
 QSharedPointer<SocketLike> KcpSslTransport::createConnection(const QString &, const QString &host, quint16 port,
                                                              QSharedPointer<SocketDnsCache> dnsCache)
@@ -370,7 +659,7 @@ QSharedPointer<SocketLike> KcpSslTransport::createConnection(const QString &, co
             [this](HostAddress::NetworkLayerProtocol protocol) { return new KcpSocketWithFilter(protocol, rpc); }));
     if (kcp) {
         QSharedPointer<SslSocket> ssl(new SslSocket(asSocketLike(kcp), sslConfig));
-        if (!ssl->handshake(false)) {
+        if (!RpcPrivate::getPrivateHelper(rpc.data())->handshake(ssl, false)) {
             return QSharedPointer<SocketLike>();
         }
         return asSocketLike(ssl);
@@ -381,7 +670,7 @@ QSharedPointer<SocketLike> KcpSslTransport::createConnection(const QString &, co
 
 QSharedPointer<BaseStreamServer> KcpSslTransport::createServer(const QString &, const HostAddress &host, quint16 port)
 {
-    QSharedPointer<BaseStreamServer> server(new SslKcpServerWithFilter(host, port, sslConfig));
+    QSharedPointer<BaseStreamServer> server(new SslKcpServerWithFilter(host, port, sslConfig, rpc));
     server->setUserData(this);
     return server;
 }
@@ -397,6 +686,16 @@ bool KcpSslTransport::canHandle(const QString &address)
             || address.startsWith("ssl+kcp://", Qt::CaseInsensitive);
 }
 
+bool KcpSslTransport::canReusePort() const
+{
+    return false;
+}
+
+bool KcpSslTransport::isPlain() const
+{
+    return false;
+}
+
 QString KcpSslTransport::getAddressTemplate()
 {
     return QStringLiteral("kcp+ssl://%1:%2");
@@ -462,7 +761,7 @@ void LafrpcHttpRequestHandler::doPOST()
     const SslConfiguration &sslConfig = userData<LafrpcHttpData>()->sslConfig;
     if (!sslConfig.isNull()) {
         QSharedPointer<SslSocket> ssl(new SslSocket(request, sslConfig));
-        if (!ssl->handshake(true)) {
+        if (rpc.isNull() || !RpcPrivate::getPrivateHelper(rpc.data())->handshake(ssl, true)) {
             return;
         }
         stream = asSocketLike(ssl);
@@ -582,12 +881,12 @@ bool HttpTransport::canHandle(const QString &address)
     return address.startsWith("http://", Qt::CaseInsensitive);
 }
 
-class LafrpcHttpsServer : public SslServer<LafrpcHttpRequestHandler>
+class LafrpcHttpsServer : public PooledSslServer<TcpServer<LafrpcHttpRequestHandler>>
 {
 public:
     explicit LafrpcHttpsServer(const HostAddress &serverAddress, quint16 serverPort,
-                               const SslConfiguration &configuration)
-        : SslServer(serverAddress, serverPort, configuration)
+                               const SslConfiguration &configuration, QPointer<Rpc> rpc)
+        : PooledSslServer(serverAddress, serverPort, configuration, rpc)
     {
         setUserData(&data);
     }
@@ -604,7 +903,7 @@ QSharedPointer<BaseStreamServer> HttpsTransport::createServer(const QString &add
         rpcPath = "/";
     }
 
-    QSharedPointer<LafrpcHttpsServer> server(new LafrpcHttpsServer(host, port, sslConfig));
+    QSharedPointer<LafrpcHttpsServer> server(new LafrpcHttpsServer(host, port, sslConfig, rpc));
     server->data.rpcPath = rpcPath;
     server->data.transport = this;
     return server;
@@ -652,7 +951,7 @@ QSharedPointer<SocketLike> HttpSslTransport::createConnection(const QString &add
         return stream;
     }
     QSharedPointer<SslSocket> ssl(new SslSocket(stream, sslConfig));
-    if (!ssl->handshake(false)) {
+    if (!RpcPrivate::getPrivateHelper(rpc.data())->handshake(ssl, false)) {
         return QSharedPointer<SocketLike>();
     }
     return asSocketLike(ssl);
@@ -689,4 +988,438 @@ bool HttpSslTransport::canHandle(const QString &address)
     return address.startsWith("http+ssl://", Qt::CaseInsensitive);
 }
 
+#ifdef Q_OS_UNIX
+static bool makeUnixAddress(const QString &path, struct sockaddr_un *addr)
+{
+    const QByteArray &encodedPath = QFile::encodeName(path);
+    if (encodedPath.isEmpty() || static_cast<size_t>(encodedPath.size()) >= sizeof(addr->sun_path)) {
+        return false;
+    }
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    memcpy(addr->sun_path, encodedPath.constData(), static_cast<size_t>(encodedPath.size()));
+    return true;
+}
+#endif
+
+QSharedPointer<SocketLike> UnixTransport::createConnection(const QString &, const QString &host, quint16,
+                                                           QSharedPointer<SocketDnsCache>)
+{
+#ifdef Q_OS_UNIX
+    struct sockaddr_un addr;
+    if (!makeUnixAddress(host, &addr)) {
+        qCWarning(logger) << "invalid unix socket path:" << host;
+        return QSharedPointer<SocketLike>();
+    }
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return QSharedPointer<SocketLike>();
+    }
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+    // the unix socket is connected at once, unless the backlog of server is full.
+    for (int i = 0;; ++i) {
+        if (::connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0) {
+            break;
+        }
+        if ((errno != EAGAIN && errno != EINTR) || i >= 100) {
+            qCDebug(logger) << "can not connect to unix socket:" << host << strerror(errno);
+            ::close(fd);
+            return QSharedPointer<SocketLike>();
+        }
+        Coroutine::msleep(10);
+    }
+    return asSocketLike(QSharedPointer<Socket>(new Socket(fd)));
+#else
+    Q_UNUSED(host);
+    return QSharedPointer<SocketLike>();
+#endif
+}
+
+QSharedPointer<BaseStreamServer> UnixTransport::createServer(const QString &address, const HostAddress &, quint16)
+{
+    qCWarning(logger) << "unix socket is served by startServer() only:" << address;
+    return QSharedPointer<BaseStreamServer>();
+}
+
+#ifdef Q_OS_UNIX
+// only a socket that refuses connections is stale. a live server still accepts them, even if it is too busy. the
+// probe is non-blocking, so a hung server with a full backlog answers EAGAIN at once instead of stalling the loop.
+static bool isStaleUnixSocket(const struct sockaddr_un *addr)
+{
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+    int rc;
+    do {
+        rc = ::connect(fd, reinterpret_cast<const struct sockaddr *>(addr), sizeof(*addr));
+    } while (rc < 0 && errno == EINTR);
+    bool stale = rc < 0 && errno == ECONNREFUSED;
+    ::close(fd);
+    return stale;
+}
+#endif
+
+bool UnixTransport::startServer(const QString &address)
+{
+#ifdef Q_OS_UNIX
+    QString path;
+    quint16 port;
+    struct sockaddr_un addr;
+    if (!parseAddress(address, path, port) || !makeUnixAddress(path, &addr)) {
+        qCWarning(logger) << address << "is invalid url.";
+        return false;
+    }
+    struct stat st;
+    const QByteArray &encodedPath = QFile::encodeName(path);
+    if (::stat(encodedPath.constData(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        if (!isStaleUnixSocket(&addr)) {
+            qCWarning(logger) << "unix socket is in use by another server:" << path;
+            return false;
+        }
+        // remove the stale socket left by the previous process.
+        ::unlink(encodedPath.constData());
+    }
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    if (::bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0 || ::listen(fd, 128) < 0) {
+        qCWarning(logger) << "can not listen on unix socket:" << path << strerror(errno);
+        ::close(fd);
+        return false;
+    }
+    QSharedPointer<Socket> server(new Socket(fd));
+    Cleaner cleaner([server, encodedPath] {
+        server->close();
+        ::unlink(encodedPath.constData());
+    });
+    Q_UNUSED(cleaner);
+    CoroutineGroup operations;
+    while (true) {
+        QSharedPointer<Socket> s(server->accept());
+        if (s.isNull()) {
+            qCWarning(logger) << "unix socket server is stopped:" << path;
+            return false;
+        }
+        QSharedPointer<SocketLike> bootstrap = asSocketLike(s);
+        operations.spawn([this, bootstrap] {
+            QSharedPointer<SocketLike> request = prepareRequest(bootstrap);
+            if (request.isNull()) {
+                bootstrap->close();
+                return;
+            }
+            QByteArray rpcHeader;
+            if (!handleRequest(request, rpcHeader)) {
+                request->close();
+            }
+        });
+    }
+#else
+    qCWarning(logger) << "unix socket is not supported in this platform:" << address;
+    return false;
+#endif
+}
+
+static void setPeerCredentials(qintptr fd, QSharedPointer<SocketChannel> channel)
+{
+#if defined(Q_OS_LINUX) && defined(SO_PEERCRED)
+    struct ucred credentials;
+    socklen_t len = sizeof(credentials);
+    if (::getsockopt(static_cast<int>(fd), SOL_SOCKET, SO_PEERCRED, &credentials, &len) == 0) {
+        channel->setProperty("peer_pid", static_cast<qint64>(credentials.pid));
+        channel->setProperty("peer_uid", static_cast<quint32>(credentials.uid));
+        channel->setProperty("peer_gid", static_cast<quint32>(credentials.gid));
+    }
+#else
+    Q_UNUSED(fd);
+    Q_UNUSED(channel);
+#endif
+}
+
+void UnixTransport::setupChannel(QSharedPointer<SocketLike> request, QSharedPointer<SocketChannel> channel)
+{
+    Transport::setupChannel(request, channel);
+    setPeerCredentials(request->fileno(), channel);
+}
+
+QSharedPointer<SocketLike> UnixTransport::prepareRequest(QSharedPointer<SocketLike> request)
+{
+    return request;
+}
+
+// fds are reused as soon as they are closed, so the peer addresses are numbered by a counter instead.
+static quint64 nextPeerNumber()
+{
+    static QAtomicInteger<quint64> counter;
+    return static_cast<quint64>(counter.fetchAndAddRelaxed(1)) + 1;
+}
+
+QString UnixTransport::getPeerAddress(QSharedPointer<SocketLike>)
+{
+    // the client socket is not bound to path.
+    return QString::fromLatin1("unix://peer-%1").arg(nextPeerNumber());
+}
+
+bool UnixTransport::parseAddress(const QString &address, QString &host, quint16 &port)
+{
+    if (!canHandle(address)) {
+        return false;
+    }
+    host = address.mid(7);
+    port = 0;
+    return !host.isEmpty();
+}
+
+QString UnixTransport::getAddressTemplate()
+{
+    return QString::fromLatin1("unix://%1");
+}
+
+QString UnixTransport::name() const
+{
+    return QString::fromUtf8("UnixTransport");
+}
+
+bool UnixTransport::canHandle(const QString &address)
+{
+#ifdef Q_OS_UNIX
+    return address.startsWith("unix://", Qt::CaseInsensitive);
+#else
+    Q_UNUSED(address);
+    return false;
+#endif
+}
+
+bool UnixTransport::isPlain() const
+{
+    return true;
+}
+
+QSharedPointer<SocketLike> ShmTransport::createConnection(const QString &address, const QString &host, quint16 port,
+                                                          QSharedPointer<SocketDnsCache> dnsCache)
+{
+    QSharedPointer<SocketLike> bootstrap = UnixTransport::createConnection(address, host, port, dnsCache);
+    if (bootstrap.isNull()) {
+        return QSharedPointer<SocketLike>();
+    }
+    QSharedPointer<ShmSocket> request = ShmSocket::handshake(bootstrap, false);
+    if (request.isNull()) {
+        bootstrap->close();
+        return QSharedPointer<SocketLike>();
+    }
+    return request;
+}
+
+QSharedPointer<SocketLike> ShmTransport::prepareRequest(QSharedPointer<SocketLike> request)
+{
+    return ShmSocket::handshake(request, true);
+}
+
+void ShmTransport::setupChannel(QSharedPointer<SocketLike> request, QSharedPointer<SocketChannel> channel)
+{
+    Transport::setupChannel(request, channel);
+    QSharedPointer<ShmSocket> shm = request.dynamicCast<ShmSocket>();
+    if (!shm.isNull()) {
+        setPeerCredentials(shm->bootstrap->fileno(), channel);
+    }
+}
+
+QString ShmTransport::getPeerAddress(QSharedPointer<SocketLike>)
+{
+    return QString::fromLatin1("shm://peer-%1").arg(nextPeerNumber());
+}
+
+bool ShmTransport::parseAddress(const QString &address, QString &host, quint16 &port)
+{
+    if (!canHandle(address)) {
+        return false;
+    }
+    const QString &name = address.mid(6);
+    if (name.isEmpty() || name.contains(QLatin1Char('/'))) {
+        return false;
+    }
+    host = QDir(QDir::tempPath()).filePath(QString::fromLatin1("lafrpc-shm-%1.sock").arg(name));
+    port = 0;
+    return true;
+}
+
+QString ShmTransport::getAddressTemplate()
+{
+    return QString::fromLatin1("shm://%1");
+}
+
+QString ShmTransport::name() const
+{
+    return QString::fromUtf8("ShmTransport");
+}
+
+bool ShmTransport::canHandle(const QString &address)
+{
+#ifdef Q_OS_UNIX
+    return address.startsWith("shm://", Qt::CaseInsensitive);
+#else
+    Q_UNUSED(address);
+    return false;
+#endif
+}
+
+bool ShmTransport::isPlain() const
+{
+    return false;
+}
+
+struct InprocRegistry
+{
+    QMutex lock;
+    QMap<QString, QPointer<Rpc>> servers;
+};
+
+// both ends of socket pair carry one link key, which is used to link the two peers. the key lives and dies with the
+// socket, so nothing is left behind whichever way the handshake ends.
+class InprocSocket : public WrappedSocket
+{
+public:
+    InprocSocket(QSharedPointer<SocketLike> backend, const QByteArray &linkKey)
+        : WrappedSocket(backend)
+        , linkKey(linkKey)
+    {
+    }
+public:
+    const QByteArray linkKey;
+};
+
+Q_GLOBAL_STATIC(InprocRegistry, inprocRegistry)
+
+bool InprocTransport::startServer(const QString &address)
+{
+    QString serverName;
+    quint16 port;
+    if (!parseAddress(address, serverName, port) || rpc.isNull()) {
+        qCWarning(logger) << address << "is invalid url.";
+        return false;
+    }
+    {
+        QMutexLocker locker(&inprocRegistry()->lock);
+        if (!inprocRegistry()->servers.value(serverName).isNull()) {
+            qCWarning(logger) << "the inproc address is in use:" << address;
+            return false;
+        }
+        inprocRegistry()->servers.insert(serverName, rpc);
+    }
+    QPointer<Rpc> rpc = this->rpc;
+    Cleaner cleaner([serverName, rpc] {
+        QMutexLocker locker(&inprocRegistry()->lock);
+        if (inprocRegistry()->servers.value(serverName) == rpc) {
+            inprocRegistry()->servers.remove(serverName);
+        }
+    });
+    Q_UNUSED(cleaner);
+    // serve until the server coroutine is killed by stopServer().
+    Event stopped;
+    stopped.tryWait();
+    return true;
+}
+
+QSharedPointer<SocketLike> InprocTransport::createConnection(const QString &, const QString &host, quint16,
+                                                             QSharedPointer<SocketDnsCache>)
+{
+#ifdef Q_OS_UNIX
+    QPointer<Rpc> server;
+    {
+        QMutexLocker locker(&inprocRegistry()->lock);
+        server = inprocRegistry()->servers.value(host);
+    }
+    if (server.isNull()) {
+        qCDebug(logger) << "there is no inproc server named" << host;
+        return QSharedPointer<SocketLike>();
+    }
+    if (server->thread() != QThread::currentThread()) {
+        qCWarning(logger) << "the inproc server" << host << "lives in another thread.";
+        return QSharedPointer<SocketLike>();
+    }
+    QSharedPointer<Transport> serverTransport;
+    for (QSharedPointer<Transport> transport : RpcPrivate::getPrivateHelper(server.data())->transports) {
+        if (transport->name() == name()) {
+            serverTransport = transport;
+            break;
+        }
+    }
+    int fds[2];
+    if (serverTransport.isNull() || ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        return QSharedPointer<SocketLike>();
+    }
+    ::fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    ::fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    const QByteArray &linkKey = randomBytes(16);
+    QSharedPointer<SocketLike> request(new InprocSocket(asSocketLike(QSharedPointer<Socket>(new Socket(fds[1]))),
+                                                        linkKey));
+    RpcPrivate::getPrivateHelper(server.data())->operations->spawn([serverTransport, request] {
+        QByteArray rpcHeader;
+        if (!serverTransport->handleRequest(request, rpcHeader)) {
+            request->close();
+        }
+    });
+    return QSharedPointer<SocketLike>(
+            new InprocSocket(asSocketLike(QSharedPointer<Socket>(new Socket(fds[0]))), linkKey));
+#else
+    qCWarning(logger) << "inproc transport is not supported in this platform:" << host;
+    return QSharedPointer<SocketLike>();
+#endif
+}
+
+QSharedPointer<BaseStreamServer> InprocTransport::createServer(const QString &address, const HostAddress &, quint16)
+{
+    qCWarning(logger) << "inproc transport is served by startServer() only:" << address;
+    return QSharedPointer<BaseStreamServer>();
+}
+
+void InprocTransport::setupChannel(QSharedPointer<SocketLike> request, QSharedPointer<SocketChannel> channel)
+{
+    Transport::setupChannel(request, channel);
+    QSharedPointer<InprocSocket> inproc = request.dynamicCast<InprocSocket>();
+    if (!inproc.isNull()) {
+        channel->setProperty("inproc_link", inproc->linkKey);
+    }
+}
+
+QString InprocTransport::getPeerAddress(QSharedPointer<SocketLike>)
+{
+    return QString::fromLatin1("inproc://peer-%1").arg(nextPeerNumber());
+}
+
+bool InprocTransport::parseAddress(const QString &address, QString &host, quint16 &port)
+{
+    if (!canHandle(address)) {
+        return false;
+    }
+    host = address.mid(9);
+    port = 0;
+    return !host.isEmpty();
+}
+
+QString InprocTransport::getAddressTemplate()
+{
+    return QString::fromLatin1("inproc://%1");
+}
+
+QString InprocTransport::name() const
+{
+    return QString::fromUtf8("InprocTransport");
+}
+
+bool InprocTransport::canHandle(const QString &address)
+{
+    return address.startsWith("inproc://", Qt::CaseInsensitive);
+}
+
+// the peers are linked to the peers of this thread only.
+bool InprocTransport::canDispatch() const
+{
+    return false;
+}
+
 END_LAFRPC_NAMESPACE
@@ -0,0 +1,238 @@
+#include "../include/wrapped_socket_p.h"
+
+using namespace qtng;
+
+BEGIN_LAFRPC_NAMESPACE
+
+WrappedSocket::WrappedSocket(QSharedPointer<SocketLike> backend)
+    : backend(backend)
+{
+}
+
+WrappedSocket::~WrappedSocket() { }
+
+qint32 WrappedSocket::send(const char *data, qint32 size)
+{
+    return backend->send(data, size);
+}
+
+qint32 WrappedSocket::sendall(const char *data, qint32 size)
+{
+    return backend->sendall(data, size);
+}
+
+qint32 WrappedSocket::send(const QByteArray &data)
+{
+    return backend->send(data);
+}
+
+qint32 WrappedSocket::sendall(const QByteArray &data)
+{
+    return backend->sendall(data);
+}
+
+qint32 WrappedSocket::peek(char *data, qint32 size)
+{
+    return backend->peek(data, size);
+}
+
+qint32 WrappedSocket::peekRaw(char *data, qint32 size)
+{
+    return backend->peekRaw(data, size);
+}
+
+qint32 WrappedSocket::recv(char *data, qint32 size)
+{
+    return backend->recv(data, size);
+}
+
+qint32 WrappedSocket::recvall(char *data, qint32 size)
+{
+    return backend->recvall(data, size);
+}
+
+QByteArray WrappedSocket::recv(qint32 size)
+{
+    return backend->recv(size);
+}
+
+QByteArray WrappedSocket::recvall(qint32 size)
+{
+    return backend->recvall(size);
+}
+
+Socket::SocketError WrappedSocket::error() const
+{
+    return backend->error();
+}
+
+QString WrappedSocket::errorString() const
+{
+    return backend->errorString();
+}
+
+HostAddress WrappedSocket::localAddress() const
+{
+    return backend->localAddress();
+}
+
+quint16 WrappedSocket::localPort() const
+{
+    return backend->localPort();
+}
+
+HostAddress WrappedSocket::peerAddress() const
+{
+    return backend->peerAddress();
+}
+
+QString WrappedSocket::peerName() const
+{
+    return backend->peerName();
+}
+
+quint16 WrappedSocket::peerPort() const
+{
+    return backend->peerPort();
+}
+
+qintptr WrappedSocket::fileno() const
+{
+    return backend->fileno();
+}
+
+Socket::SocketType WrappedSocket::type() const
+{
+    return backend->type();
+}
+
+Socket::SocketState WrappedSocket::state() const
+{
+    return backend->state();
+}
+
+HostAddress::NetworkLayerProtocol WrappedSocket::protocol() const
+{
+    return backend->protocol();
+}
+
+QSharedPointer<SocketLike> WrappedSocket::accept()
+{
+    return backend->accept();
+}
+
+bool WrappedSocket::bind(const HostAddress &address, quint16 port, Socket::BindMode mode)
+{
+    return backend->bind(address, port, mode);
+}
+
+bool WrappedSocket::bind(quint16 port, Socket::BindMode mode)
+{
+    return backend->bind(port, mode);
+}
+
+bool WrappedSocket::connect(const HostAddress &addr, quint16 port)
+{
+    return backend->connect(addr, port);
+}
+
+bool WrappedSocket::connect(const QString &hostName, quint16 port, QSharedPointer<SocketDnsCache> dnsCache)
+{
+    return backend->connect(hostName, port, dnsCache);
+}
+
+bool WrappedSocket::listen(int backlog)
+{
+    return backend->listen(backlog);
+}
+
+bool WrappedSocket::setOption(Socket::SocketOption option, const QVariant &value)
+{
+    return backend->setOption(option, value);
+}
+
+QVariant WrappedSocket::option(Socket::SocketOption option) const
+{
+    return backend->option(option);
+}
+
+Socket *WrappedSocket::acceptRaw()
+{
+    return backend->acceptRaw();
+}
+
+bool WrappedSocket::isValid() const
+{
+    return backend->isValid();
+}
+
+void WrappedSocket::close()
+{
+    backend->close();
+}
+
+void WrappedSocket::abort()
+{
+    backend->abort();
+}
+
+PlainSocket::PlainSocket(QSharedPointer<SocketLike> backend)
+    : WrappedSocket(backend)
+{
+}
+
+QSharedPointer<SocketLike> PlainSocket::wrap(QSharedPointer<SocketLike> socket)
+{
+    if (socket.isNull() || !socket.dynamicCast<PlainSocket>().isNull()) {
+        return socket;
+    }
+    return QSharedPointer<SocketLike>(new PlainSocket(socket));
+}
+
+qintptr PlainSocket::plainFileno(QSharedPointer<SocketLike> socket)
+{
+    SocketLike *s = socket.data();
+    while (WrappedSocket *wrapped = dynamic_cast<WrappedSocket *>(s)) {
+        if (dynamic_cast<PlainSocket *>(wrapped)) {
+            return wrapped->backend->fileno();
+        }
+        s = wrapped->backend.data();
+    }
+    return -1;
+}
+
+RecyclableSocket::RecyclableSocket(QSharedPointer<SocketLike> backend, const Recycler &recycler)
+    : WrappedSocket(backend)
+    , recycler(recycler)
+    , reusable(false)
+{
+}
+
+RecyclableSocket::~RecyclableSocket()
+{
+    if (reusable && recycler) {
+        recycler(backend);
+    }
+}
+
+void RecyclableSocket::close()
+{
+    reusable = false;
+    backend->close();
+}
+
+void RecyclableSocket::abort()
+{
+    reusable = false;
+    backend->abort();
+}
+
+void RecyclableSocket::markReusable(QSharedPointer<SocketLike> socket)
+{
+    QSharedPointer<RecyclableSocket> recyclable = socket.dynamicCast<RecyclableSocket>();
+    if (!recyclable.isNull() && recyclable->backend->isValid()) {
+        recyclable->reusable = true;
+    }
+}
+
+END_LAFRPC_NAMESPACE
@@ -0,0 +1,286 @@
+#include <QtCore/qbytearray.h>
+#include <QtCore/qloggingcategory.h>
+#include <limits>
+#include <string.h>
+#include "../include/zerocopy_p.h"
+#ifdef Q_OS_LINUX
+#  include <errno.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/sendfile.h>
+#endif
+#ifdef Q_OS_UNIX
+#  include <sys/mman.h>
+#endif
+
+static Q_LOGGING_CATEGORY(logger, "lafrpc.zerocopy");
+
+// the kernel is asked to read this much ahead of the sending position.
+const static qint64 READ_AHEAD = 1024 * 1024 * 4;
+const static qint64 MIN_MAP_SIZE = 1024 * 64;
+
+BEGIN_LAFRPC_NAMESPACE
+
+qint64 ZeroCopy::sendfile(qintptr fileFd, qint64 offset, qintptr socketFd, qint64 count)
+{
+#ifdef Q_OS_LINUX
+    if (fileFd < 0 || socketFd < 0) {
+        return -1;
+    }
+    off_t pos = static_cast<off_t>(offset);
+    qint64 sent = 0;
+    while (sent < count) {
+        ssize_t bs = ::sendfile(static_cast<int>(socketFd), static_cast<int>(fileFd), &pos,
+                                static_cast<size_t>(count - sent));
+        if (bs > 0) {
+            sent += bs;
+        } else if (bs == 0) {
+            // the file is shorter than expected.
+            return sent;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            qtng::ScopedIoWatcher watcher(qtng::EventLoopCoroutine::Write, socketFd);
+            if (!watcher.start()) {
+                return sent;
+            }
+        } else if (sent == 0 && (errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+            return -1;
+        } else {
+            qCDebug(logger) << "sendfile() failed:" << errno;
+            return sent;
+        }
+    }
+    return sent;
+#else
+    Q_UNUSED(fileFd);
+    Q_UNUSED(offset);
+    Q_UNUSED(socketFd);
+    Q_UNUSED(count);
+    return -1;
+#endif
+}
+
+#ifdef Q_OS_LINUX
+// move the bytes in the pipe to the file. if the file system can not splice, copy them through user space.
+static bool drainPipe(int pipeFd, int fileFd, loff_t *pos, qint64 size)
+{
+    while (size > 0) {
+        ssize_t bs = ::splice(pipeFd, nullptr, fileFd, pos, static_cast<size_t>(size), SPLICE_F_MOVE);
+        if (bs > 0) {
+            size -= bs;
+            continue;
+        } else if (bs < 0 && errno == EINTR) {
+            continue;
+        } else if (bs < 0 && errno != EINVAL) {
+            qCDebug(logger) << "splice() to file failed:" << errno;
+            return false;
+        }
+        // the coroutine stack is small, so the buffer is on the heap.
+        QByteArray buf(static_cast<int>(qMin<qint64>(size, 1024 * 64)), Qt::Uninitialized);
+        ssize_t readBytes = ::read(pipeFd, buf.data(), static_cast<size_t>(buf.size()));
+        if (readBytes <= 0 || ::pwrite(fileFd, buf.constData(), static_cast<size_t>(readBytes), *pos) != readBytes) {
+            qCDebug(logger) << "can not write to file:" << errno;
+            return false;
+        }
+        *pos += readBytes;
+        size -= readBytes;
+    }
+    return true;
+}
+#endif
+
+qint64 ZeroCopy::splice(qintptr socketFd, qintptr fileFd, qint64 offset, qint64 count)
+{
+#ifdef Q_OS_LINUX
+    if (fileFd < 0 || socketFd < 0) {
+        return -1;
+    }
+    int pipeFds[2];
+    if (::pipe2(pipeFds, O_CLOEXEC | O_NONBLOCK) < 0) {
+        return -1;
+    }
+    // a larger pipe moves more pages at once, the default size is fine if the kernel refuses.
+    ::fcntl(pipeFds[1], F_SETPIPE_SZ, 1024 * 1024);
+    loff_t pos = static_cast<loff_t>(offset);
+    qint64 received = 0;
+    bool unsupported = false;
+    while (received < count) {
+        ssize_t bs = ::splice(static_cast<int>(socketFd), nullptr, pipeFds[1], nullptr,
+                              static_cast<size_t>(count - received), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (bs > 0) {
+            // the pipe is drained every time, so it is empty before the next splice().
+            if (!drainPipe(pipeFds[0], static_cast<int>(fileFd), &pos, bs)) {
+                break;
+            }
+            received += bs;
+        } else if (bs == 0) {
+            // the peer closed the socket.
+            break;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            qtng::ScopedIoWatcher watcher(qtng::EventLoopCoroutine::Read, socketFd);
+            if (!watcher.start()) {
+                break;
+            }
+        } else {
+            unsupported = received == 0 && (errno == EINVAL || errno == ENOSYS);
+            if (!unsupported) {
+                qCDebug(logger) << "splice() from socket failed:" << errno;
+            }
+            break;
+        }
+    }
+    ::close(pipeFds[0]);
+    ::close(pipeFds[1]);
+    return unsupported ? -1 : received;
+#else
+    Q_UNUSED(socketFd);
+    Q_UNUSED(fileFd);
+    Q_UNUSED(offset);
+    Q_UNUSED(count);
+    return -1;
+#endif
+}
+
+void ZeroCopy::preallocate(qintptr fileFd, qint64 offset, qint64 size)
+{
+#ifdef Q_OS_LINUX
+    if (fileFd < 0 || size <= offset) {
+        return;
+    }
+    // it is only a hint, the writing goes on without it.
+    if (::fallocate(static_cast<int>(fileFd), FALLOC_FL_KEEP_SIZE, static_cast<off_t>(offset),
+                    static_cast<off_t>(size - offset)) < 0) {
+        qCDebug(logger) << "fallocate() failed:" << errno;
+    }
+#else
+    Q_UNUSED(fileFd);
+    Q_UNUSED(offset);
+    Q_UNUSED(size);
+#endif
+}
+
+QByteArray ZeroCopy::readPacket(qtng::FileLike *f, qint32 size)
+{
+    MappedFile *mapped = dynamic_cast<MappedFile *>(f);
+    if (mapped) {
+        return mapped->slice(size);
+    }
+    QByteArray buf(size, Qt::Uninitialized);
+    qint32 readBytes = f->read(buf.data(), size);
+    if (readBytes < 0) {
+        qCWarning(logger) << "rpc file read error.";
+        return QByteArray();
+    }
+    buf.resize(readBytes);
+    return buf;
+}
+
+MappedFile::MappedFile(QSharedPointer<QFile> file, uchar *data, qint64 length)
+    : file(file)
+    , data(data)
+    , length(length)
+    , pos(0)
+{
+#ifdef Q_OS_UNIX
+    ::madvise(data, static_cast<size_t>(length), MADV_SEQUENTIAL);
+    ::madvise(data, static_cast<size_t>(qMin(length, READ_AHEAD)), MADV_WILLNEED);
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+QSharedPointer<MappedFile> MappedFile::map(QSharedPointer<QFile> file)
+{
+    if (file.isNull() || !file->isOpen()) {
+        return QSharedPointer<MappedFile>();
+    }
+    const qint64 length = file->size();
+    // reading the small files is cheaper than mapping them, and the huge files can not be mapped in 32-bit systems.
+    if (length < MIN_MAP_SIZE
+        || static_cast<quint64>(length) > static_cast<quint64>(std::numeric_limits<size_t>::max())) {
+        return QSharedPointer<MappedFile>();
+    }
+    uchar *data = file->map(0, length);
+    if (!data) {
+        qCDebug(logger) << "can not map file:" << file->fileName() << file->errorString();
+        return QSharedPointer<MappedFile>();
+    }
+    return QSharedPointer<MappedFile>(new MappedFile(file, data, length));
+}
+
+void MappedFile::advise(qint64 newPos)
+{
+#ifdef Q_OS_UNIX
+    // the read-ahead windows are aligned to pages because the mapping starts at a page.
+    if (newPos / READ_AHEAD != pos / READ_AHEAD) {
+        const qint64 start = (newPos / READ_AHEAD + 1) * READ_AHEAD;
+        if (start < length) {
+            ::madvise(data + start, static_cast<size_t>(qMin(READ_AHEAD, length - start)), MADV_WILLNEED);
+        }
+    }
+#else
+    Q_UNUSED(newPos);
+#endif
+}
+
+qint32 MappedFile::read(char *data, qint32 size)
+{
+    if (!this->data || size < 0) {
+        return -1;
+    }
+    const qint32 n = static_cast<qint32>(qMin<qint64>(size, length - pos));
+    memcpy(data, this->data + pos, static_cast<size_t>(n));
+    advise(pos + n);
+    pos += n;
+    return n;
+}
+
+qint32 MappedFile::write(const char *data, qint32 size)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(size);
+    return -1;
+}
+
+void MappedFile::close()
+{
+    if (data) {
+        file->unmap(data);
+        data = nullptr;
+    }
+    file->close();
+}
+
+qint64 MappedFile::size()
+{
+    return length;
+}
+
+QByteArray MappedFile::slice(qint32 size)
+{
+    if (!data || size <= 0) {
+        return QByteArray();
+    }
+    const qint32 n = static_cast<qint32>(qMin<qint64>(size, length - pos));
+    const QByteArray bs = QByteArray::fromRawData(reinterpret_cast<const char *>(data + pos), n);
+    advise(pos + n);
+    pos += n;
+    return bs;
+}
+
+bool MappedFile::seek(qint64 pos)
+{
+    if (pos < 0 || pos > length) {
+        return false;
+    }
+    this->pos = pos;
+    return true;
+}
+
+END_LAFRPC_NAMESPACE
@@ -0,0 +1,340 @@
+#include <QtCore/qcoreapplication.h>
+#include <QtCore/qcryptographichash.h>
+#include <QtCore/qdebug.h>
+#include <QtCore/qdir.h>
+#include <QtCore/qfile.h>
+#include <QtCore/qrandom.h>
+#include <QtCore/qtemporarydir.h>
+#include "lafrpc.h"
+
+using namespace qtng;
+using namespace lafrpc;
+
+// round trips of RpcFile and RpcDir between two rpc in one process. exit with 1 if any case fails.
+
+const QString ServerAddress = "tcp://127.0.0.1:7944";
+
+static QTemporaryDir *workDir = nullptr;
+static int failures = 0;
+
+static QString workPath(const QString &name)
+{
+    return workDir->filePath(name);
+}
+
+static bool writeRandomFile(const QString &path, qint64 size)
+{
+    QFile f(path);
+    if (!f.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    QByteArray buf(1024 * 64, Qt::Uninitialized);
+    qint64 written = 0;
+    while (written < size) {
+        const int n = static_cast<int>(qMin<qint64>(buf.size(), size - written));
+        QRandomGenerator::global()->fillRange(reinterpret_cast<quint32 *>(buf.data()), buf.size() / 4);
+        if (f.write(buf.constData(), n) != n) {
+            return false;
+        }
+        written += n;
+    }
+    return true;
+}
+
+static QByteArray hashFile(const QString &path)
+{
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly)) {
+        return QByteArray();
+    }
+    QCryptographicHash hasher(QCryptographicHash::Sha256);
+    hasher.addData(&f);
+    return hasher.result();
+}
+
+static void check(bool ok, const char *name)
+{
+    if (ok) {
+        qDebug() << "passed:" << name;
+    } else {
+        qDebug() << "FAILED:" << name;
+        ++failures;
+    }
+}
+
+class Demo : public QObject
+{
+    Q_OBJECT
+public slots:
+    QSharedPointer<RpcFile> getFile(const QString &name, const QString &mode)
+    {
+        const QString &path = workPath(name);
+        QSharedPointer<RpcFile> f(new RpcFile(path));
+        if (mode == "parallel") {
+            f->setParallelStreams(4);
+        } else if (mode == "resume") {
+            f->setResumable(true);
+        } else if (mode == "delta") {
+            f->setDelta(true);
+        } else if (mode == "chunked") {
+            f->setChunked(true);
+        }
+        operations.spawn([f, path] { f->readFromPath(path); });
+        return f;
+    }
+
+    QSharedPointer<RpcDir> getDir(const QString &name, int concurrency, quint64 packThreshold)
+    {
+        QSharedPointer<RpcDir> d(new RpcDir(workPath(name)));
+        d->setConcurrency(concurrency);
+        d->setPackThreshold(packThreshold);
+        operations.spawn([d] { d->readFromPath(); });
+        return d;
+    }
+private:
+    CoroutineGroup operations;
+};
+
+static QSharedPointer<RpcFile> getFile(QSharedPointer<Peer> peer, const QString &name, const QString &mode)
+{
+    return peer->call("demo.getFile", name, mode).value<QSharedPointer<RpcFile>>();
+}
+
+static void testParallelStreams(QSharedPointer<Peer> peer)
+{
+    // large enough for four streams with a full window each.
+    const QString &source = workPath("parallel.bin");
+    const QString &target = workPath("parallel.out");
+    writeRandomFile(source, 1024 * 1024 * 8);
+    QSharedPointer<RpcFile> f = getFile(peer, "parallel.bin", "parallel");
+    check(!f.isNull() && f->parallelStreams() == 4, "parallel streams are negotiated");
+    check(!f.isNull() && f->writeToPath(target) && hashFile(source) == hashFile(target), "parallel streams");
+}
+
+static bool copyPrefix(const QString &source, const QString &target, qint64 size, const QByteArray &tail)
+{
+    QFile in(source);
+    QFile out(target);
+    if (!in.open(QIODevice::ReadOnly) || !out.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    const QByteArray &data = in.read(size);
+    return out.write(data) == data.size() && out.write(tail) == tail.size();
+}
+
+// receive the file into target with resume, and return the bytes really received, or -1.
+static qint64 resumeFile(QSharedPointer<Peer> peer, const QString &name, const QString &mode, const QString &target)
+{
+    QSharedPointer<RpcFile> f = getFile(peer, name, mode);
+    qint64 received = 0;
+    RpcFile::ProgressCallback progress = [&received](qint64 bs, quint64, quint64) -> bool {
+        received += bs;
+        return true;
+    };
+    if (f.isNull() || !f->writeToPath(target, progress, true)) {
+        return -1;
+    }
+    return received;
+}
+
+static void testResume(QSharedPointer<Peer> peer)
+{
+    const qint64 size = 1024 * 1024 * 4;
+    const QString &source = workPath("resume.bin");
+    const QString &target = workPath("resume.out");
+    writeRandomFile(source, size);
+    const QByteArray &sourceHash = hashFile(source);
+
+    // the receiver holds the first 3MB from a broken transfer.
+    copyPrefix(source, target, 1024 * 1024 * 3, QByteArray());
+    qint64 received = resumeFile(peer, "resume.bin", "resume", target);
+    check(received == 1024 * 1024 && hashFile(target) == sourceHash, "resume from the held prefix");
+
+    // the old file is longer than the new one, but starts with its whole content.
+    copyPrefix(source, target, size, QByteArray(1024 * 100, 'x'));
+    received = resumeFile(peer, "resume.bin", "resume", target);
+    check(received == 0 && hashFile(target) == sourceHash, "resume truncates the longer file");
+
+    // the old file is longer and different, so it starts over.
+    writeRandomFile(target, size + 1024 * 100);
+    received = resumeFile(peer, "resume.bin", "resume", target);
+    check(received == size && hashFile(target) == sourceHash, "resume starts over if the prefix is different");
+
+    // the sender is not resumable, the longer file is still truncated.
+    writeRandomFile(target, size + 1024 * 100);
+    received = resumeFile(peer, "resume.bin", "", target);
+    check(received == size && hashFile(target) == sourceHash, "resume truncates without negotiation");
+}
+
+static bool patchFile(const QString &path, qint64 pos, const QByteArray &data)
+{
+    QFile f(path);
+    return f.open(QIODevice::ReadWrite) && f.seek(pos) && f.write(data) == data.size();
+}
+
+static void testDelta(QSharedPointer<Peer> peer)
+{
+    const qint64 size = 1024 * 1024 * 2;
+    const QString &source = workPath("delta.bin");
+    const QString &target = workPath("delta.out");
+    writeRandomFile(source, size);
+    // the receiver holds an old version with a few changed bytes.
+    copyPrefix(source, target, size, QByteArray());
+    patchFile(target, 1024 * 500, QByteArray(100, 'x'));
+    QFile::setPermissions(target, QFile::ReadOwner | QFile::WriteOwner);
+    const QFile::Permissions permissions = QFile::permissions(target);
+    QSharedPointer<RpcFile> f = getFile(peer, "delta.bin", "delta");
+    check(!f.isNull() && f->delta(), "delta is negotiated");
+    check(!f.isNull() && f->writeToPath(target) && hashFile(source) == hashFile(target), "delta");
+    check(QFile::permissions(target) == permissions, "delta keeps the permissions");
+    check(!QFile::exists(target + ".lafrpc-delta"), "delta removes the temporary file");
+}
+
+static void testChunked(QSharedPointer<Peer> peer)
+{
+    const qint64 size = 1024 * 1024 * 2;
+    const QString &source = workPath("chunked.bin");
+    writeRandomFile(source, size);
+    QSharedPointer<NativeRpcChunkStore> store(new NativeRpcChunkStore(workPath("chunks"), 1024 * 1024 * 64));
+
+    QSharedPointer<RpcFile> f = getFile(peer, "chunked.bin", "chunked");
+    check(!f.isNull() && f->chunked(), "chunked is negotiated");
+    if (!f.isNull()) {
+        f->setChunkStore(store);
+    }
+    const QString &target = workPath("chunked.out");
+    check(!f.isNull() && f->writeToPath(target) && hashFile(source) == hashFile(target), "chunked");
+    check(store->usedBytes() == static_cast<quint64>(size), "chunked fills the chunk store");
+
+    // the same content again, with a changed block. the other chunks are taken from the store.
+    patchFile(source, 1024 * 1024, QByteArray(100, 'x'));
+    f = getFile(peer, "chunked.bin", "chunked");
+    if (!f.isNull()) {
+        f->setChunkStore(store);
+    }
+    const QString &target2 = workPath("chunked2.out");
+    check(!f.isNull() && f->writeToPath(target2) && hashFile(source) == hashFile(target2),
+          "chunked with stored chunks");
+}
+
+// write a tree of files with the given sizes, every third one in a sub directory.
+static bool writeRandomDir(const QString &root, const QList<qint64> &sizes)
+{
+    if (!QDir().mkpath(root + "/sub/deeper")) {
+        return false;
+    }
+    for (int i = 0; i < sizes.size(); ++i) {
+        const QString &subPath = i % 3 == 0 ? "sub/" : (i % 3 == 1 ? "sub/deeper/" : "");
+        if (!writeRandomFile(root + "/" + subPath + QString::number(i) + ".bin", sizes.at(i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// compare the files and directories of two trees.
+static bool sameDir(const QString &source, const QString &target)
+{
+    const QDir sourceDir(source);
+    const QDir targetDir(target);
+    const QDir::Filters filters = QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot | QDir::Hidden;
+    const QStringList &names = sourceDir.entryList(filters, QDir::Name);
+    if (names != targetDir.entryList(filters, QDir::Name)) {
+        return false;
+    }
+    for (const QString &name : names) {
+        const QFileInfo sourceInfo(sourceDir.filePath(name));
+        if (sourceInfo.isDir()) {
+            if (!sameDir(sourceInfo.filePath(), targetDir.filePath(name))) {
+                return false;
+            }
+        } else if (hashFile(sourceInfo.filePath()) != hashFile(targetDir.filePath(name))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool receiveDir(QSharedPointer<Peer> peer, const QString &name, int concurrency, quint64 packThreshold)
+{
+    QSharedPointer<RpcDir> d =
+            peer->call("demo.getDir", name, concurrency, packThreshold).value<QSharedPointer<RpcDir>>();
+    const QString &target = workPath(name + ".out");
+    QDir(target).removeRecursively();
+    return !d.isNull() && QDir().mkpath(target) && d->writeToPath(target) && sameDir(workPath(name), target);
+}
+
+static void testDirConcurrency(QSharedPointer<Peer> peer)
+{
+    QList<qint64> sizes;
+    for (int i = 0; i < 9; ++i) {
+        sizes.append(1024 * 512 + i * 1000);
+    }
+    sizes.append(0);
+    check(writeRandomDir(workPath("concurrent"), sizes), "write the directory");
+    check(receiveDir(peer, "concurrent", 1, 0), "directory one file at a time");
+    check(receiveDir(peer, "concurrent", 4, 0), "directory four files at a time");
+}
+
+static void testDirPacking(QSharedPointer<Peer> peer)
+{
+    // many small files are packed, the large ones still have their own sub channels.
+    QList<qint64> sizes;
+    for (int i = 0; i < 200; ++i) {
+        sizes.append(1 + i * 37);
+    }
+    sizes.append(1024 * 1024);
+    sizes.append(1024 * 1024 + 1);
+    check(writeRandomDir(workPath("packed"), sizes), "write the directory");
+    check(receiveDir(peer, "packed", 1, 1024 * 16), "directory with packed files");
+    check(receiveDir(peer, "packed", 4, 1024 * 16), "directory with packed and concurrent files");
+    check(receiveDir(peer, "packed", 4, 1024 * 1024 * 4), "directory with every file packed");
+}
+
+class ServerCoroutine : public Coroutine
+{
+public:
+    virtual void run() override
+    {
+        QSharedPointer<Rpc> rpc = Rpc::builder(MessagePack).myPeerName("server").create();
+        QSharedPointer<Demo> demo(new Demo());
+        rpc->registerInstance(demo, "demo");
+        rpc->startServer(ServerAddress);
+    }
+};
+
+class ClientCoroutine : public Coroutine
+{
+public:
+    virtual void run() override
+    {
+        msleep(200);  // wait for server to start.
+        QSharedPointer<Rpc> rpc = Rpc::builder(MessagePack).myPeerName("client").create();
+        QSharedPointer<Peer> peer = rpc->connect(ServerAddress);
+        if (peer.isNull()) {
+            check(false, "connect to server");
+            return;
+        }
+        testParallelStreams(peer);
+        testResume(peer);
+        testDelta(peer);
+        testChunked(peer);
+        testDirConcurrency(peer);
+        testDirPacking(peer);
+    }
+};
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    QTemporaryDir dir;
+    workDir = &dir;
+    CoroutineGroup operations;
+    operations.start(new ServerCoroutine, "server");
+    operations.start(new ClientCoroutine, "client");
+    operations.get("client")->join();
+    operations.killall();
+    return failures == 0 ? 0 : 1;
+}
+
+#include "transfer.moc"
@@ -0,0 +1,171 @@
+#include <QtCore/qcoreapplication.h>
+#include <QtCore/qdebug.h>
+#include <QtCore/qtemporarydir.h>
+#include "lafrpc.h"
+
+using namespace qtng;
+using namespace lafrpc;
+
+// round trips over the local transports, server and clients in one thread. exit with 1 if any case fails.
+
+static QTemporaryDir *workDir = nullptr;
+static int failures = 0;
+
+static void check(bool ok, const QString &name)
+{
+    if (ok) {
+        qDebug() << "passed:" << name;
+    } else {
+        qDebug() << "FAILED:" << name;
+        ++failures;
+    }
+}
+
+class Demo : public QObject
+{
+    Q_OBJECT
+public slots:
+    QString sayHello(const QString &name) { return QString::fromUtf8("hello, %1").arg(name); }
+    QByteArray echo(const QByteArray &data) { return data; }
+};
+
+// call the server over the address, and check the address of the peer the server sees.
+static void testTransport(QSharedPointer<Rpc> server, const QString &address, const QString &scheme)
+{
+    const QString &clientName = "client-" + scheme;
+    QSharedPointer<Rpc> client = Rpc::builder(MessagePack).myPeerName(clientName).create();
+    QSharedPointer<Peer> peer = client->connect(address);
+    check(!peer.isNull(), scheme + " connects");
+    if (peer.isNull()) {
+        return;
+    }
+    check(peer->call("demo.sayHello", scheme).toString() == "hello, " + scheme, scheme + " calls");
+    // larger than the buffers of the transports, so it is sent in many pieces.
+    QByteArray data(1024 * 1024 * 2, Qt::Uninitialized);
+    for (int i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<char>(i * 7);
+    }
+    check(peer->call("demo.echo", data).toByteArray() == data, scheme + " echoes a large argument");
+    QSharedPointer<Peer> itsPeer = server->get(clientName);
+    check(!itsPeer.isNull() && itsPeer->address().startsWith(scheme + "://peer-"), scheme + " names the peer");
+    client->shutdown();
+}
+
+static void testUnix(QSharedPointer<Rpc> server, const QString &address)
+{
+    testTransport(server, address, "unix");
+    // a second server can not take the socket of a live one.
+    QSharedPointer<Rpc> other = Rpc::builder(MessagePack).myPeerName("other").create();
+    other->startServer(address, false);
+    Coroutine::msleep(200);
+    QSharedPointer<Rpc> client = Rpc::builder(MessagePack).myPeerName("client-unix-again").create();
+    QSharedPointer<Peer> peer = client->connect(address);
+    check(!peer.isNull() && !server->get("client-unix-again").isNull(), "unix keeps the live socket");
+    client->shutdown();
+    other->shutdown();
+}
+
+static void testInproc(QSharedPointer<Rpc> server, const QString &address)
+{
+    testTransport(server, address, "inproc");
+    // the serialized calls return the same as the calls passing references.
+    QSharedPointer<Rpc> client =
+            Rpc::builder(MessagePack).myPeerName("client-serialized").forceSerialization(true).create();
+    QSharedPointer<Peer> peer = client->connect(address);
+    check(!peer.isNull() && peer->call("demo.sayHello", "inproc").toString() == "hello, inproc",
+          "inproc calls with serialization");
+    client->shutdown();
+    // the links of closed peers are dropped, and the server still accepts new ones.
+    for (int i = 0; i < 10; ++i) {
+        client = Rpc::builder(MessagePack).myPeerName("client-inproc-again").create();
+        peer = client->connect(address);
+        check(!peer.isNull() && peer->call("demo.sayHello", "again").toString() == "hello, again",
+              "inproc reconnects");
+        client->shutdown();
+    }
+    client = Rpc::builder(MessagePack).myPeerName("client-nowhere").create();
+    check(client->connect("inproc://nowhere").isNull(), "inproc fails without a server");
+    client->shutdown();
+}
+
+// wait until the server has handled the closed connections.
+static bool waitFor(const std::function<bool()> &done)
+{
+    for (int i = 0; i < 50; ++i) {
+        if (done()) {
+            return true;
+        }
+        Coroutine::msleep(100);
+    }
+    return done();
+}
+
+static void testPeerDirectory(QSharedPointer<Rpc> server, const QString &address)
+{
+    // three peers share a name, so they are in one entry by name but have their own ids.
+    QList<QSharedPointer<Rpc>> clients;
+    for (int i = 0; i < 3; ++i) {
+        QSharedPointer<Rpc> client = Rpc::builder(MessagePack).myPeerName("client-many").create();
+        if (!client->connect(address).isNull()) {
+            clients.append(client);
+        }
+    }
+    check(clients.size() == 3, "peers connect");
+    const QList<QSharedPointer<Peer>> &many = server->getAll("client-many");
+    check(many.size() == 3, "peers are found by name");
+    check(server->getAllPeerNames().contains("client-many"), "peer names are listed");
+    bool found = true;
+    for (const QSharedPointer<Peer> &peer : many) {
+        found = found && server->getById(peer->id()) == peer && server->getAllPeers().contains(peer);
+    }
+    check(found, "peers are found by id");
+
+    // closing one removes it from every index, the others stay.
+    const quint64 closedId = many.isEmpty() ? 0 : many.first()->id();
+    if (!many.isEmpty()) {
+        many.first()->close();
+    }
+    check(waitFor([server] { return server->getAll("client-many").size() == 2; }), "peer is removed by name");
+    check(server->getById(closedId).isNull(), "peer is removed by id");
+    check(!server->get("client-many").isNull(), "the other peers stay");
+
+    for (QSharedPointer<Rpc> client : clients) {
+        client->shutdown();
+    }
+    check(waitFor([server] { return server->getAll("client-many").isEmpty(); }), "peers are removed after shutdown");
+    check(!server->getAllPeerNames().contains("client-many"), "peer name is removed with its last peer");
+}
+
+class TestCoroutine : public Coroutine
+{
+public:
+    virtual void run() override
+    {
+        const QString &unixAddress = "unix://" + workDir->filePath("lafrpc.sock");
+        const QString &shmAddress = "shm://lafrpc-transports-" + QString::number(QCoreApplication::applicationPid());
+        const QString &inprocAddress = "inproc://lafrpc-transports";
+        QSharedPointer<Rpc> server = Rpc::builder(MessagePack).myPeerName("server").create();
+        server->registerInstance(QSharedPointer<Demo>::create(), "demo");
+        server->startServers({ unixAddress, shmAddress, inprocAddress }, false);
+        msleep(200);  // wait for server to start.
+        testUnix(server, unixAddress);
+        testTransport(server, shmAddress, "shm");
+        testInproc(server, inprocAddress);
+        testPeerDirectory(server, unixAddress);
+        server->shutdown();
+    }
+};
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    QTemporaryDir dir;
+    workDir = &dir;
+    CoroutineGroup operations;
+    operations.start(new TestCoroutine, "test");
+    operations.get("test")->join();
+    operations.killall();
+    return failures == 0 ? 0 : 1;
+}
+
+#include "transports.moc"